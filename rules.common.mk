@@ -1,4 +1,4 @@
-clean all run gdb valgrind cscope check:
+clean all run gdb valgrind cscope check bench:
 	cd $(top_srcdir) && $(MAKE) $@
 
-.PHONY: clean all run gdb valgrind cscope check
+.PHONY: clean all run gdb valgrind cscope check bench
@@ -18,8 +18,20 @@
 #include <libintl.h>
 #include <iostream>
 #include <exception>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sigc++/bind.h>
 #include <glibmm/exception.h>
+#include <glibmm/miscutils.h>
+#include <glibmm/main.h>
+#include <giomm/init.h>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -28,23 +40,199 @@
 #include "yatta/options.hh"
 #include "yatta/ui/main.hh"
 #include "yatta/curl/manager.hh"
+#include "yatta/file/chunk.hh"
+#include "yatta/metrics.hh"
+#include "yatta/queue.hh"
+#include "yatta/ioqueue.hh"
+#include "yatta/download.hh"
+#include "yatta/instance.hh"
+
+namespace
+{
+    void on_stream_finished (Glib::RefPtr<Glib::MainLoop> loop)
+    {
+        loop->quit ();
+    }
+
+    void on_stream_error (const Gio::Error &error,
+                          Glib::RefPtr<Glib::MainLoop> loop, int *status)
+    {
+        std::cerr << error.what () << std::endl;
+        *status = 1;
+        loop->quit ();
+    }
+
+    // --output: no interface, just the one download written out in order
+    int stream (const Yatta::Options &options, int argc, char **argv)
+    {
+        if (argc != 2) {
+            std::cerr << "--output takes exactly one URL" << std::endl;
+            return 1;
+        }
+
+        int fd = STDOUT_FILENO;
+        if (options.output () != "-") {
+            fd = open (options.output ().c_str (),
+                       O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) {
+                std::cerr << options.output () << ": "
+                          << g_strerror (errno) << std::endl;
+                return 1;
+            }
+        }
+
+        if (!options.metrics_socket ().empty ())
+            Yatta::Metrics::get ().serve (options.metrics_socket ());
+
+        // a reader going away shows up as a write error instead
+        std::signal (SIGPIPE, SIG_IGN);
+        Gio::init ();
+
+        Glib::RefPtr<Glib::MainLoop> loop = Glib::MainLoop::create ();
+        int status = 0;
+        {
+            Yatta::Download download (argv[1], fd);
+            download.connect_signal_finished
+                (sigc::bind (sigc::ptr_fun (&on_stream_finished), loop));
+            download.connect_signal_error
+                (sigc::bind (sigc::ptr_fun (&on_stream_error), loop,
+                             &status));
+
+            download.start ();
+            loop->run ();
+
+            // leaving the scope waits for the last writes
+        }
+
+        if (fd != STDOUT_FILENO)
+            close (fd);
+
+        return status;
+    }
+
+    // the URLs on the command line and in --import, as Queue::import ()
+    // reads them
+    std::string gather_urls (const Yatta::Options &options,
+                             int argc, char **argv)
+    {
+        // whatever gtk left for itself isn't a URL
+        std::ostringstream urls;
+        for (int i = 1; i < argc; ++i)
+            if (std::strstr (argv[i], "://"))
+                urls << argv[i] << '\n';
+
+        if (options.import_file () == "-") {
+            urls << std::cin.rdbuf ();
+        } else if (!options.import_file ().empty ()) {
+            std::ifstream file (options.import_file ().c_str ());
+            if (file)
+                urls << file.rdbuf ();
+            else
+                g_warning ("Could not open %s for import",
+                           options.import_file ().c_str ());
+        }
+
+        return urls.str ();
+    }
+
+    void on_handoff (const std::string &urls, const std::string &dirname,
+                     Yatta::Queue *queue, Yatta::UI::Main *ui_kit)
+    {
+        std::istringstream in (urls);
+        if (queue->import (in, dirname))
+            queue->start ();
+
+        ui_kit->present ();
+    }
+}
 
 int main (int argc, char **argv)
 {
+    gint64 started = g_get_monotonic_time ();
+
     // initialize gettext
     bindtextdomain (GETTEXT_PACKAGE, PROGRAMNAME_LOCALEDIR);
     bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
     textdomain (GETTEXT_PACKAGE);
 
-    // initialize curl backend
-    Yatta::Curl::Manager::get ()->attach ();
+    // curl itself starts up with the first transfer
+    Yatta::Curl::Manager::install ();
+
+    // local files are better off copied by the kernel than by curl
+    Yatta::Chunk::register_factory
+        ("file", Yatta::ChunkFactoryPtr (new Yatta::File::ChunkFactory));
 
     try {
         // get options
         Yatta::Options options;
 
+        // streaming runs without a display, so look at our own options
+        // before gtk does. whatever gtk understands is left for it
+        options.set_ignore_unknown_options (true);
+        options.parse (argc, argv);
+        options.set_ignore_unknown_options (false);
+
+        if (options.io_mode () == "direct")
+            Yatta::IOQueue::default_mode (Yatta::IOQueue::DIRECT);
+        else if (options.io_mode () == "writeback")
+            Yatta::IOQueue::default_mode (Yatta::IOQueue::WRITEBACK);
+        else if (options.io_mode () != "buffered")
+            std::cerr << "Unknown I/O mode " << options.io_mode ()
+                      << ", using buffered" << std::endl;
+
+        Yatta::Download::default_min_speed (options.min_speed ());
+
+        if (options.compressed () == "decode")
+            Yatta::Download::default_compression (Yatta::Download::DECODE);
+        else if (options.compressed () == "keep")
+            Yatta::Download::default_compression (Yatta::Download::KEEP);
+        else if (options.compressed () != "no")
+            std::cerr << "Unknown compression mode "
+                      << options.compressed () << ", using no"
+                      << std::endl;
+
+        if (!options.output ().empty ())
+            return stream (options, argc, argv);
+
+        // if we're already up, that one takes the URLs and we're done
+        // before gtk is even loaded. timing startup wants a cold one
+        std::string urls = gather_urls (options, argc, argv);
+        Yatta::Instance instance;
+        if (!options.new_instance () && !options.measure_startup ()) {
+            if (Yatta::Instance::hand_off (urls, Glib::get_current_dir ()))
+                return 0;
+
+            // another one may have started up in between. if it wasn't
+            // that, a second window would only fight the first one
+            if (!instance.listen ()) {
+                if (Yatta::Instance::hand_off (urls,
+                                               Glib::get_current_dir ()))
+                    return 0;
+
+                std::cerr << "Could not reach the running Yatta, or take "
+                          << "its place. Use --new-instance to start "
+                          << "another" << std::endl;
+                return 1;
+            }
+        }
+
+        // only now that it's ours, or the one running would lose it
+        if (!options.metrics_socket ().empty ())
+            Yatta::Metrics::get ().serve (options.metrics_socket ());
+
         // initialize ui kit
-        Yatta::UI::Main ui_kit (argc, argv, options);
+        Yatta::UI::Main ui_kit (argc, argv, options, started);
+
+        // downloads given on the command line land in the current directory
+        Yatta::Queue queue;
+        if (options.max_active ())
+            queue.max_active (options.max_active ());
+        std::istringstream in (urls);
+        if (queue.import (in, Glib::get_current_dir ()))
+            queue.start ();
+
+        instance.connect_signal_handoff
+            (sigc::bind (sigc::ptr_fun (&on_handoff), &queue, &ui_kit));
 
         // run main loop
         ui_kit.run ();
@@ -0,0 +1,317 @@
+/* chunk-bench.cc -- micro-benchmarks for chunk bookkeeping and writes
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+
+#include <glibmm.h>
+#include <giomm.h>
+
+#include "microbench.hh"
+#include "../chunk.hh"
+#include "../download.hh"
+#include "../ioqueue.hh"
+
+using Yatta::Bench::State;
+using Yatta::Bench::run;
+
+namespace
+{
+    // chunk which never touches the network; data is pushed in by hand
+    class NullChunk : public Yatta::Chunk
+    {
+    public:
+        typedef std::shared_ptr<NullChunk> Ptr;
+
+        NullChunk (const std::string &url, size_t offset, size_t size,
+                   size_t length) :
+            Yatta::Chunk (url, offset, size),
+            _length (length)
+        {}
+
+        virtual void start () { if (!running ()) signal_started (); }
+        virtual void stop () { if (running ()) signal_stopped (); }
+        virtual void pause () { paused (true); }
+        virtual void resume () { paused (false); }
+
+        virtual bool resumable () const { return true; }
+        virtual size_t content_length () const { return _length; }
+        virtual size_t total_size () const { return _length; }
+
+        void answer () { signal_headers (); }
+        void feed (void *data, size_t nbytes) { signal_write (data, nbytes); }
+
+        void finish ()
+        {
+            stop ();
+            signal_finished ();
+        }
+
+    private:
+        size_t _length;
+    };
+
+    bool by_offset (const NullChunk::Ptr &a, const NullChunk::Ptr &b)
+    {
+        return a->offset () < b->offset ();
+    }
+
+    class NullChunkFactory : public Yatta::ChunkFactory
+    {
+    public:
+        NullChunkFactory () : length (0) {}
+        virtual ~NullChunkFactory () noexcept {}
+
+        virtual Yatta::ChunkPtr create_chunk (const std::string &url,
+                                              size_t offset,
+                                              size_t size)
+        {
+            NullChunk::Ptr chunk (new NullChunk (url, offset, size, length));
+            created.push_back (chunk);
+            return chunk;
+        }
+
+        size_t length;                    // content length to report
+        std::vector<NullChunk::Ptr> created;
+    };
+
+    std::shared_ptr<NullChunkFactory> factory;
+
+    char buffer[256 * 1024];
+
+    void feed_to_target (NullChunk::Ptr chunk)
+    {
+        while (chunk->current_pos () < chunk->target_pos ())
+            chunk->feed (buffer, std::min (sizeof (buffer),
+                                           chunk->target_pos () -
+                                           chunk->current_pos ()));
+    }
+
+    // Download with the interesting protected members made public
+    class BenchDownload : public Yatta::Download
+    {
+    public:
+        BenchDownload () :
+            Yatta::Download ("null://bench", Glib::get_tmp_dir ())
+        {}
+
+        using Yatta::Download::add_chunks;
+        using Yatta::Download::normalize_chunks;
+
+        // get to a state where the size is known and there are `chunks'
+        // chunks, leaving factory->created sorted by offset
+        void prime (size_t length, unsigned short chunks)
+        {
+            factory->created.clear ();
+            factory->length = length;
+
+            max_chunks (chunks);
+            start ();
+
+            // forget about the probe, then have the first chunk answer
+            NullChunk::Ptr first = factory->created.front ();
+            factory->created.clear ();
+            factory->created.push_back (first);
+            first->answer ();
+
+            std::sort (factory->created.begin (), factory->created.end (),
+                       &by_offset);
+        }
+    };
+
+    void on_write (Yatta::Chunk &, void *, size_t)
+    {
+    }
+
+    void bench_signal_write (State &state)
+    {
+        factory->length = 0;
+        Yatta::ChunkPtr chunk = Yatta::Chunk::create ("null://bench", 0);
+        chunk->connect_signal_write (sigc::ptr_fun (&on_write));
+
+        NullChunk::Ptr null_chunk = factory->created.back ();
+        while (state.next ())
+            null_chunk->feed (buffer, state.arg ());
+
+        factory->created.clear ();
+    }
+
+    class NullSink : public Yatta::ChunkSink
+    {
+    public:
+        virtual void on_chunk_write (Yatta::Chunk &, void *, size_t) {}
+    };
+
+    void bench_sink_write (State &state)
+    {
+        factory->length = 0;
+        Yatta::ChunkPtr chunk = Yatta::Chunk::create ("null://bench", 0);
+        NullSink sink;
+        chunk->sink (&sink);
+
+        NullChunk::Ptr null_chunk = factory->created.back ();
+        while (state.next ())
+            null_chunk->feed (buffer, state.arg ());
+
+        chunk->sink (NULL);
+        factory->created.clear ();
+    }
+
+    void bench_add_chunks (State &state)
+    {
+        while (state.next ()) {
+            state.pause ();
+            BenchDownload *dl = new BenchDownload;
+            dl->prime (1 << 30, 1);
+            state.resume ();
+
+            dl->add_chunks (state.arg ());
+
+            state.pause ();
+            delete dl;
+            state.resume ();
+        }
+    }
+
+    void bench_normalize_chunks (State &state)
+    {
+        BenchDownload dl;
+        dl.prime (1 << 30, state.arg ());
+
+        while (state.next ())
+            dl.normalize_chunks ();
+    }
+
+    // finish chunks in order so that each one merges into its successor
+    void bench_chunk_merge (State &state)
+    {
+        BenchDownload *dl = 0;
+        size_t next = 0;
+
+        while (state.next ()) {
+            state.pause ();
+            if (!dl || next + 1 >= factory->created.size ()) {
+                delete dl;
+                dl = new BenchDownload;
+                dl->prime (state.arg () * 65536, state.arg ());
+                next = 0;
+            }
+
+            NullChunk::Ptr chunk = factory->created[next++];
+            feed_to_target (chunk);
+            state.resume ();
+
+            chunk->finish ();
+        }
+
+        delete dl;
+    }
+
+    // enqueue only: the file is never opened so nothing gets written
+    void bench_ioqueue_enqueue (State &state)
+    {
+        Yatta::IOQueue *queue = 0;
+        size_t offset = 0;
+
+        while (state.next ()) {
+            if (!queue) {
+                state.pause ();
+                queue = new Yatta::IOQueue (Glib::get_tmp_dir ());
+                offset = 0;
+                state.resume ();
+            }
+
+            queue->write (offset, buffer, state.arg ());
+            offset += state.arg ();
+
+            if (offset >= 64 * 1024 * 1024) {
+                state.pause ();
+                delete queue;
+                queue = 0;
+                state.resume ();
+            }
+        }
+
+        delete queue;
+    }
+
+    // enqueue plus completion: batches of writes, drained by the
+    // IOQueue destructor
+    void bench_ioqueue_write (State &state)
+    {
+        const std::string filename = "yatta-microbench.out";
+        Glib::RefPtr<Glib::MainContext> context =
+            Glib::MainContext::get_default ();
+        Yatta::IOQueue *queue = 0;
+        size_t offset = 0;
+        unsigned batch = 0;
+
+        while (state.next ()) {
+            if (!queue) {
+                state.pause ();
+                queue = new Yatta::IOQueue (Glib::get_tmp_dir (), filename);
+                offset = 0;
+
+                // the only event source is the file open callback
+                context->iteration (true);
+                state.resume ();
+            }
+
+            queue->write (offset, buffer, state.arg ());
+            offset += state.arg ();
+
+            if (++batch % 256 == 0) {
+                delete queue;
+                queue = 0;
+            }
+        }
+
+        delete queue;
+        std::remove (Glib::build_filename (Glib::get_tmp_dir (),
+                                           filename).c_str ());
+    }
+}
+
+int main ()
+{
+    Glib::init ();
+    Gio::init ();
+
+    factory.reset (new NullChunkFactory);
+    Yatta::Chunk::register_factory (factory);
+
+    run ("Chunk::signal_write", &bench_signal_write, 1024);
+    run ("Chunk::signal_write", &bench_signal_write, 16384);
+    run ("Chunk::signal_write/sink", &bench_sink_write, 1024);
+    run ("Chunk::signal_write/sink", &bench_sink_write, 16384);
+    run ("Download::add_chunks", &bench_add_chunks, 4);
+    run ("Download::add_chunks", &bench_add_chunks, 32);
+    run ("Download::add_chunks", &bench_add_chunks, 256);
+    run ("Download::normalize_chunks", &bench_normalize_chunks, 4);
+    run ("Download::normalize_chunks", &bench_normalize_chunks, 32);
+    run ("Download::normalize_chunks", &bench_normalize_chunks, 256);
+    run ("Download::on_chunk_finished", &bench_chunk_merge, 32);
+    run ("Download::on_chunk_finished", &bench_chunk_merge, 256);
+    run ("IOQueue::write/enqueue", &bench_ioqueue_enqueue, 1024);
+    run ("IOQueue::write/enqueue", &bench_ioqueue_enqueue, 16384);
+    run ("IOQueue::write/complete", &bench_ioqueue_write, 16384);
+    run ("IOQueue::write/complete", &bench_ioqueue_write, 262144);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/* download-bench.cc -- end to end throughput benchmark for Download
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glibmm.h>
+#include <giomm.h>
+
+#include "rangeserver.hh"
+#include "../download.hh"
+#include "../ioqueue.hh"
+#include "../curl/manager.hh"
+
+using Yatta::Bench::RangeServer;
+
+// count every allocation made by the process under test
+namespace
+{
+    std::atomic<size_t> allocations (0);
+}
+
+void *operator new (size_t size)
+{
+    allocations.fetch_add (1, std::memory_order_relaxed);
+    void *ptr = std::malloc (size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc ();
+    return ptr;
+}
+
+void operator delete (void *ptr) noexcept
+{
+    std::free (ptr);
+}
+
+namespace
+{
+    const size_t MiB = 1024 * 1024;
+
+    struct Profile
+    {
+        const char         *name;
+        RangeServer::Config config;
+    };
+
+    struct Sample
+    {
+        double wall;        // seconds
+        double cpu;         // user + system seconds
+        long   syscalls;    // read/write style syscalls
+        long   ctxswitches;
+        size_t allocations;
+
+        static Sample take ()
+        {
+            Sample s;
+
+            struct timeval tv;
+            gettimeofday (&tv, NULL);
+            s.wall = tv.tv_sec + tv.tv_usec / 1e6;
+
+            struct rusage ru;
+            getrusage (RUSAGE_SELF, &ru);
+            s.cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+            s.ctxswitches = ru.ru_nvcsw + ru.ru_nivcsw;
+
+            // /proc/self/io only knows about read(2)/write(2) and friends,
+            // which is close enough to spot a change in batching
+            s.syscalls = 0;
+            std::ifstream io ("/proc/self/io");
+            std::string key;
+            long value;
+            while (io >> key >> value)
+                if (key == "syscr:" || key == "syscw:")
+                    s.syscalls += value;
+
+            s.allocations = allocations;
+            return s;
+        }
+    };
+
+    struct Quit
+    {
+        Glib::RefPtr<Glib::MainLoop> loop;
+        bool &flag;
+
+        Quit (Glib::RefPtr<Glib::MainLoop> loop, bool &flag) :
+            loop (loop), flag (flag) {}
+
+        void operator () ()
+        {
+            flag = true;
+            loop->quit ();
+        }
+
+        bool timeout ()
+        {
+            loop->quit ();
+            return false;
+        }
+    };
+
+    struct Storage
+    {
+        const char          *name;
+        Yatta::IOQueue::Mode mode;
+    };
+
+    const Storage storage_modes[] = {
+        { "buffered",  Yatta::IOQueue::BUFFERED },
+        { "direct",    Yatta::IOQueue::DIRECT },
+        { "writeback", Yatta::IOQueue::WRITEBACK }
+    };
+
+    void run (const Profile &profile, const RangeServer &server,
+              const std::string &dirname, const Storage &storage,
+              size_t size, unsigned short chunks)
+    {
+        const std::string filename = "yatta-bench.out";
+        const std::string path = Glib::build_filename (dirname, filename);
+        Glib::RefPtr<Glib::MainLoop> loop = Glib::MainLoop::create ();
+        bool finished = false;
+        Quit quit (loop, finished);
+
+        Yatta::IOQueue::default_mode (storage.mode);
+
+        Sample before = Sample::take ();
+        {
+            Yatta::Download dl (server.url (size), dirname, filename);
+            dl.max_chunks (chunks);
+            dl.connect_signal_finished (sigc::slot<void> (quit));
+
+            sigc::connection timeout = Glib::signal_timeout ().connect
+                (sigc::mem_fun (quit, &Quit::timeout), 300 * 1000);
+
+            dl.start ();
+            loop->run ();
+            timeout.disconnect ();
+
+            // leaving the scope flushes the IOQueue
+        }
+        Sample after = Sample::take ();
+
+        struct stat st;
+        bool complete = finished && stat (path.c_str (), &st) == 0 &&
+            size_t (st.st_size) == size;
+        std::remove (path.c_str ());
+
+        double wall = after.wall - before.wall;
+        double gb = double (size) / (1024 * MiB);
+
+        std::printf ("%-9s %-16s %-9s %7lu %6u %9.2f %9.2f %10ld %9ld "
+                     "%10lu %s\n",
+                     profile.name, dirname.c_str (), storage.name,
+                     static_cast<unsigned long> (size / MiB), chunks,
+                     size / MiB / wall,
+                     (after.cpu - before.cpu) / gb,
+                     after.syscalls - before.syscalls,
+                     after.ctxswitches - before.ctxswitches,
+                     static_cast<unsigned long> (after.allocations -
+                                                 before.allocations),
+                     complete ? "ok" : "INCOMPLETE");
+        std::fflush (stdout);
+    }
+}
+
+int main (int argc, char **argv)
+{
+    bool quick = false;
+    std::vector<std::string> dirs;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp (argv[i], "--quick") == 0)
+            quick = true;
+        else
+            dirs.push_back (argv[i]);
+    }
+
+    // every directory is a storage target, e.g. tmpfs vs. a real disk
+    if (dirs.empty ())
+        dirs.push_back (Glib::get_tmp_dir ());
+
+    Profile profiles[3];
+    profiles[0].name = "loopback";
+
+    profiles[1].name = "wan";
+    profiles[1].config.latency_ms = 20;
+    profiles[1].config.bandwidth = 16 * MiB;
+
+    profiles[2].name = "lossy";
+    profiles[2].config.latency_ms = 5;
+    profiles[2].config.drop_rate = 0.05;
+    profiles[2].config.error_rate = 0.02;
+
+    // fork the servers before any threads exist
+    std::vector<RangeServer *> servers;
+    for (size_t i = 0; i < G_N_ELEMENTS (profiles); ++i)
+        servers.push_back (new RangeServer (profiles[i].config));
+
+    Glib::init ();
+    Gio::init ();
+    Yatta::Curl::Manager::install ();
+
+    const size_t sizes[] = { 1 * MiB, 16 * MiB, 128 * MiB };
+    const unsigned short chunk_counts[] = { 1, 4, 16 };
+
+    std::printf ("%-9s %-16s %-9s %7s %6s %9s %9s %10s %9s %10s\n",
+                 "profile", "storage", "io", "MiB", "chunks", "MB/s",
+                 "cpu s/GB", "syscalls", "ctxsw", "allocs");
+
+    for (size_t p = 0; p < G_N_ELEMENTS (profiles); ++p)
+        for (size_t d = 0; d < dirs.size (); ++d)
+            for (size_t m = 0; m < G_N_ELEMENTS (storage_modes); ++m)
+                for (size_t s = 0; s < G_N_ELEMENTS (sizes); ++s) {
+                    if (quick && sizes[s] > 16 * MiB)
+                        continue;
+
+                    for (size_t c = 0; c < G_N_ELEMENTS (chunk_counts); ++c)
+                        run (profiles[p], *servers[p], dirs[d],
+                             storage_modes[m], sizes[s], chunk_counts[c]);
+                }
+
+    for (size_t i = 0; i < servers.size (); ++i)
+        delete servers[i];
+
+    return 0;
+}
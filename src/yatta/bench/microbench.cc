@@ -0,0 +1,97 @@
+/* microbench.cc -- minimal Google Benchmark style runner
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <time.h>
+
+#include "microbench.hh"
+
+using Yatta::Bench::State;
+
+namespace
+{
+    const double min_time = 0.5; // seconds per reported measurement
+
+    double now ()
+    {
+        struct timespec ts;
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+}
+
+State::State (size_t iterations, long arg) :
+    _iterations (iterations),
+    _remaining (iterations),
+    _arg (arg),
+    _started (now ()),
+    _elapsed (0),
+    _running (true)
+{}
+
+void State::pause ()
+{
+    if (!_running)
+        return;
+
+    _elapsed += now () - _started;
+    _running = false;
+}
+
+void State::resume ()
+{
+    if (_running)
+        return;
+
+    _started = now ();
+    _running = true;
+}
+
+void Yatta::Bench::run (const std::string &name, Function fn, long arg)
+{
+    std::ostringstream label;
+    label << name;
+    if (arg)
+        label << "/" << arg;
+
+    size_t iterations = 1;
+    for (;;) {
+        State state (iterations, arg);
+        fn (state);
+        state.pause ();
+
+        if (state.elapsed () >= min_time || iterations >= 1000000000) {
+            std::printf ("%-36s %12lu %12.1f ns\n", label.str ().c_str (),
+                         static_cast<unsigned long> (iterations),
+                         state.elapsed () * 1e9 / iterations);
+            std::fflush (stdout);
+            return;
+        }
+
+        // aim a little past min_time, but don't grow too fast on noise
+        double factor = state.elapsed () > 0 ?
+            min_time * 1.4 / state.elapsed () : 100;
+        if (factor > 100)
+            factor = 100;
+        if (factor < 2)
+            factor = 2;
+
+        iterations = static_cast<size_t> (iterations * factor);
+    }
+}
@@ -0,0 +1,77 @@
+/* microbench.hh -- minimal Google Benchmark style runner
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_BENCH_MICROBENCH_H
+#define YATTA_BENCH_MICROBENCH_H
+
+#include <string>
+
+namespace Yatta
+{
+    namespace Bench
+    {
+        /**
+         * @brief: Timing state handed to every benchmark function
+         *
+         * Usage mirrors Google Benchmark:
+         *     while (state.next ()) { ... }
+         */
+        class State
+        {
+        public:
+            State (size_t iterations, long arg);
+
+            bool next ()
+            {
+                if (_remaining == 0) {
+                    pause ();
+                    return false;
+                }
+
+                --_remaining;
+                return true;
+            }
+
+            // exclude setup and teardown from the measurement
+            void pause ();
+            void resume ();
+
+            long arg () const { return _arg; }
+            size_t iterations () const { return _iterations; }
+            double elapsed () const { return _elapsed; }
+
+        private:
+            size_t _iterations;
+            size_t _remaining;
+            long   _arg;
+            double _started;
+            double _elapsed;
+            bool   _running;
+        };
+
+        typedef void (*Function) (State &state);
+
+        /**
+         * @brief: Run fn with increasing iteration counts until the
+         *         timing is stable, then print ns per iteration.
+         */
+        void run (const std::string &name, Function fn, long arg = 0);
+    }
+}
+
+#endif // YATTA_BENCH_MICROBENCH_H
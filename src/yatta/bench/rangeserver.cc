@@ -0,0 +1,292 @@
+/* rangeserver.cc -- localhost HTTP range server for benchmarks
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <strings.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "rangeserver.hh"
+
+using Yatta::Bench::RangeServer;
+
+namespace
+{
+    const size_t block_size = 16384;
+
+    double now ()
+    {
+        struct timeval tv;
+        gettimeofday (&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+
+    double chance ()
+    {
+        return std::rand () / (RAND_MAX + 1.0);
+    }
+
+    bool send_all (int fd, const char *data, size_t size)
+    {
+        while (size) {
+            ssize_t sent = send (fd, data, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+
+            data += sent;
+            size -= sent;
+        }
+
+        return true;
+    }
+
+    // case-insensitive lookup of a header value within a request
+    std::string header (const std::string &request, const char *name)
+    {
+        size_t len = std::strlen (name);
+        size_t pos = 0;
+        while ((pos = request.find ("\r\n", pos)) != std::string::npos) {
+            pos += 2;
+            if (strncasecmp (request.c_str () + pos, name, len) == 0 &&
+                request[pos + len] == ':') {
+                size_t start = request.find_first_not_of (' ', pos + len + 1);
+                size_t end = request.find ("\r\n", start);
+                return request.substr (start, end - start);
+            }
+        }
+
+        return std::string ();
+    }
+}
+
+RangeServer::RangeServer (const Config &config) :
+    _config (config),
+    _port (0),
+    _child (-1)
+{
+    int fd = socket (AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error (std::strerror (errno));
+
+    struct sockaddr_in addr;
+    std::memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t addrlen = sizeof (addr);
+    if (bind (fd, reinterpret_cast<sockaddr *> (&addr), sizeof (addr)) < 0 ||
+        listen (fd, 128) < 0 ||
+        getsockname (fd, reinterpret_cast<sockaddr *> (&addr), &addrlen) < 0) {
+        int err = errno;
+        close (fd);
+        throw std::runtime_error (std::strerror (err));
+    }
+
+    _port = ntohs (addr.sin_port);
+
+    _child = fork ();
+    if (_child < 0) {
+        int err = errno;
+        close (fd);
+        throw std::runtime_error (std::strerror (err));
+    }
+
+    if (_child == 0) {
+        // own process group so that the destructor can take down every
+        // connection handler at once
+        setpgid (0, 0);
+        serve (fd);
+        _exit (0);
+    }
+
+    close (fd);
+}
+
+RangeServer::~RangeServer ()
+{
+    if (_child <= 0)
+        return;
+
+    kill (-_child, SIGTERM);
+    waitpid (_child, NULL, 0);
+}
+
+std::string RangeServer::url (size_t size) const
+{
+    std::ostringstream ss;
+    ss << "http://127.0.0.1:" << _port << "/" << size;
+    return ss.str ();
+}
+
+void RangeServer::serve (int listen_fd)
+{
+    // let the kernel reap connection handlers
+    signal (SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        int fd = accept (listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        pid_t pid = fork ();
+        if (pid == 0) {
+            close (listen_fd);
+            std::srand (getpid () ^ std::time (NULL));
+            serve_connection (fd);
+            _exit (0);
+        }
+
+        close (fd);
+    }
+}
+
+void RangeServer::serve_connection (int fd)
+{
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    std::string buffer;
+    char block[block_size];
+
+    // keep-alive loop: one iteration per request
+    for (;;) {
+        size_t end;
+        while ((end = buffer.find ("\r\n\r\n")) == std::string::npos) {
+            ssize_t got = recv (fd, block, sizeof (block), 0);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0) {
+                close (fd);
+                return;
+            }
+
+            buffer.append (block, got);
+        }
+
+        std::string request = buffer.substr (0, end + 2);
+        buffer.erase (0, end + 4);
+
+        bool head = request.compare (0, 5, "HEAD ") == 0;
+        size_t path = request.find (' ') + 1;
+        size_t size = std::strtoul (request.c_str () + path + 1, NULL, 10);
+
+        if (_config.latency_ms)
+            usleep (_config.latency_ms * 1000);
+
+        std::ostringstream reply;
+
+        if (chance () < _config.error_rate) {
+            reply << "HTTP/1.1 503 Service Unavailable\r\n"
+                  << "Content-Length: 0\r\n"
+                  << "Retry-After: 1\r\n\r\n";
+            if (!send_all (fd, reply.str ().data (), reply.str ().size ()))
+                break;
+            continue;
+        }
+
+        // work out which range was asked for
+        size_t first = 0, last = size ? size - 1 : 0;
+        bool partial = false;
+        std::string range = header (request, "Range");
+        if (range.compare (0, 6, "bytes=") == 0) {
+            char *dash;
+            first = std::strtoul (range.c_str () + 6, &dash, 10);
+            if (*dash == '-' && dash[1] >= '0' && dash[1] <= '9')
+                last = std::min (last, size_t (std::strtoul (dash + 1,
+                                                              NULL, 10)));
+            partial = true;
+
+            if (first >= size || first > last) {
+                reply << "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                      << "Content-Range: bytes */" << size << "\r\n"
+                      << "Content-Length: 0\r\n\r\n";
+                if (!send_all (fd, reply.str ().data (),
+                               reply.str ().size ()))
+                    break;
+                continue;
+            }
+        }
+
+        size_t length = size ? last - first + 1 : 0;
+
+        if (partial)
+            reply << "HTTP/1.1 206 Partial Content\r\n"
+                  << "Content-Range: bytes " << first << "-" << last
+                  << "/" << size << "\r\n";
+        else
+            reply << "HTTP/1.1 200 OK\r\n";
+
+        reply << "Content-Length: " << length << "\r\n"
+              << "Content-Type: application/octet-stream\r\n"
+              << "Accept-Ranges: bytes\r\n\r\n";
+
+        if (!send_all (fd, reply.str ().data (), reply.str ().size ()))
+            break;
+
+        if (head)
+            continue;
+
+        // failure injection: cut the body short and hang up
+        size_t cutoff = length;
+        if (chance () < _config.drop_rate)
+            cutoff = static_cast<size_t> (length * chance ());
+
+        double start = now ();
+        size_t sent = 0;
+        while (sent < cutoff) {
+            size_t n = std::min (cutoff - sent, block_size);
+            for (size_t i = 0; i < n; ++i)
+                block[i] = pattern (first + sent + i);
+
+            if (!send_all (fd, block, n))
+                break;
+            sent += n;
+
+            // bandwidth shaping: sleep until we're back under the limit
+            if (_config.bandwidth) {
+                double ahead = double (sent) / _config.bandwidth -
+                    (now () - start);
+                if (ahead > 0)
+                    usleep (static_cast<useconds_t> (ahead * 1e6));
+            }
+        }
+
+        if (sent < length)
+            break;
+    }
+
+    close (fd);
+}
@@ -0,0 +1,78 @@
+/* rangeserver.hh -- localhost HTTP range server for benchmarks
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_BENCH_RANGESERVER_H
+#define YATTA_BENCH_RANGESERVER_H
+
+#include <string>
+#include <sys/types.h>
+
+namespace Yatta
+{
+    namespace Bench
+    {
+        /**
+         * @brief: HTTP/1.1 server on 127.0.0.1 serving synthetic files
+         *
+         * GET /<size> returns size bytes of a fixed pattern, honouring
+         * Range headers. The server runs in a forked child so that its
+         * CPU time and syscalls don't pollute the measurements of the
+         * process under test.
+         */
+        class RangeServer
+        {
+        public:
+            struct Config
+            {
+                Config () :
+                    latency_ms (0),
+                    bandwidth (0),
+                    drop_rate (0.0),
+                    error_rate (0.0)
+                {}
+
+                unsigned latency_ms; // delay before every response
+                size_t bandwidth;    // bytes/s per connection, 0 = unlimited
+                double drop_rate;    // chance of cutting a body short
+                double error_rate;   // chance of answering 503
+            };
+
+            explicit RangeServer (const Config &config = Config ());
+            ~RangeServer ();
+
+            unsigned short port () const { return _port; }
+            std::string url (size_t size) const;
+
+            // byte found at offset in every served file
+            static unsigned char pattern (size_t offset)
+            { return static_cast<unsigned char> (offset % 251); }
+
+        private:
+            RangeServer (const RangeServer &) = delete;
+
+            void serve (int listen_fd);
+            void serve_connection (int fd);
+
+            Config         _config;
+            unsigned short _port;
+            pid_t          _child;
+        };
+    }
+}
+
+#endif // YATTA_BENCH_RANGESERVER_H
@@ -0,0 +1,34 @@
+EXTRA_PROGRAMS += download-bench
+
+download_bench_SOURCES = \
+	src/yatta/bench/rangeserver.cc \
+	src/yatta/bench/rangeserver.hh \
+	src/yatta/bench/download-bench.cc
+
+download_bench_LDADD = \
+	libyatta.la
+
+download_bench_CXXFLAGS = \
+	$(AM_CXXFLAGS) \
+	$(CURL_CFLAGS) \
+	$(GTKMM_CFLAGS)
+
+EXTRA_PROGRAMS += chunk-bench
+
+chunk_bench_SOURCES = \
+	src/yatta/bench/microbench.cc \
+	src/yatta/bench/microbench.hh \
+	src/yatta/bench/chunk-bench.cc
+
+chunk_bench_LDADD = \
+	libyatta.la
+
+chunk_bench_CXXFLAGS = \
+	$(AM_CXXFLAGS) \
+	$(GTKMM_CFLAGS)
+
+CLEANFILES += download-bench chunk-bench
+
+bench: chunk-bench download-bench
+	./chunk-bench
+	./download-bench $(BENCH_FLAGS)
@@ -17,24 +17,37 @@
  */
 
 #include <limits>
+#include <glib.h>
+#include <vector>
 #include "chunk.hh"
+#include "pool.hh"
+#include "trace.hh"
 
 using namespace Yatta;
 using namespace std;
 
-struct Chunk::Private
+struct Chunk::Private : Pooled<Chunk::Private>
 {
-    sigc::signal<void, Ptr,
+    sigc::signal<void, Chunk &,
                  void * /* buffer */,
                  size_t /* nbytes */> signal_write;
+    sigc::signal<bool, Chunk &,
+                 int /* fd */,
+                 size_t /* nbytes */> signal_copy;
+    sigc::signal<void, Ptr> signal_headers;
     sigc::signal<void, Ptr> signal_started;
     sigc::signal<void, Ptr> signal_stopped;
     sigc::signal<void, Ptr> signal_reset;
     sigc::signal<void, Ptr> signal_finished;
 
+    ChunkSink *sink;
+
     // some states
     std::string url;
+    std::string accept_encoding;
     bool running;
+    bool paused;
+    Failure failure;
     size_t offset;
     size_t target_pos;
     size_t current_pos;
@@ -42,8 +55,12 @@ struct Chunk::Private
     Private (const std::string &url,
              size_t offset,
              size_t size) :
+        sink (NULL),
         url (url),
+        accept_encoding (),
         running (false),
+        paused (false),
+        failure (NONE),
         offset (offset),
         target_pos (offset + size),
         current_pos (offset)
@@ -53,12 +70,70 @@ struct Chunk::Private
     }
 };
 
+namespace
+{
+    // scheme, or empty for all of them
+    typedef std::vector<std::pair<std::string, ChunkFactoryPtr> >
+    factory_list_t;
+
+    factory_list_t &factories ()
+    {
+        static factory_list_t instance;
+        return instance;
+    }
+
+    std::string scheme_of (const std::string &url)
+    {
+        std::string::size_type colon = url.find (':');
+        if (colon == std::string::npos)
+            return std::string ();
+
+        gchar *scheme = g_ascii_strdown (url.c_str (), colon);
+        std::string result (scheme);
+        g_free (scheme);
+        return result;
+    }
+}
+
+Chunk::Ptr
+Chunk::create (const std::string &url,
+               size_t offset,
+               size_t size)
+{
+    g_assert (!factories ().empty ());
+
+    std::string scheme = scheme_of (url);
+    for (factory_list_t::reverse_iterator i = factories ().rbegin ();
+         i != factories ().rend (); ++i)
+        if (i->first.empty () || i->first == scheme)
+            return i->second->create_chunk (url, offset, size);
+
+    // let whoever came last have a go, and fail properly
+    return factories ().back ().second->create_chunk (url, offset, size);
+}
+
+void
+Chunk::register_factory (ChunkFactoryPtr factory)
+{
+    register_factory (std::string (), factory);
+}
+
+void
+Chunk::register_factory (const std::string &scheme,
+                         ChunkFactoryPtr factory)
+{
+    factories ().push_back (std::make_pair (scheme, factory));
+}
+
 Chunk::Chunk (const std::string &url,
               size_t offset,
               size_t size) :
     _priv (new Private (url, offset, size))
 {}
 
+Chunk::~Chunk ()
+{}
+
 void
 Chunk::merge (Ptr previous_chunk)
 {
@@ -80,6 +155,30 @@ Chunk::running () const
     return _priv->running;
 }
 
+bool
+Chunk::paused () const
+{
+    return _priv->paused;
+}
+
+void
+Chunk::paused (bool paused)
+{
+    _priv->paused = paused;
+}
+
+Chunk::Failure
+Chunk::failure () const
+{
+    return _priv->failure;
+}
+
+void
+Chunk::failure (Failure failure)
+{
+    _priv->failure = failure;
+}
+
 size_t
 Chunk::offset () const
 {
@@ -104,12 +203,54 @@ Chunk::url () const
     return _priv->url;
 }
 
+std::string
+Chunk::accept_encoding () const
+{
+    return _priv->accept_encoding;
+}
+
+void
+Chunk::accept_encoding (const std::string &encodings)
+{
+    _priv->accept_encoding = encodings;
+}
+
+void
+Chunk::target_pos (size_t target_pos)
+{
+    _priv->target_pos = target_pos;
+}
+
+ChunkSink *
+Chunk::sink () const
+{
+    return _priv->sink;
+}
+
+void
+Chunk::sink (ChunkSink *sink)
+{
+    _priv->sink = sink;
+}
+
 sigc::connection
 Chunk::connect_signal_write (WriteSlot slot)
 {
     return _priv->signal_write.connect (slot);
 }
 
+sigc::connection
+Chunk::connect_signal_copy (CopySlot slot)
+{
+    return _priv->signal_copy.connect (slot);
+}
+
+sigc::connection
+Chunk::connect_signal_headers (HeadersSlot slot)
+{
+    return _priv->signal_headers.connect (slot);
+}
+
 sigc::connection
 Chunk::connect_signal_started (StartedSlot slot)
 {
@@ -132,16 +273,44 @@ Chunk::connect_signal_finished (FinishedSlot slot)
 void
 Chunk::signal_write (void *buffer, size_t nbytes)
 {
-    _priv->signal_write (shared_from_this (), buffer, nbytes);
+    YATTA_TRACE_SCOPE ("Chunk::signal_write");
+    if (_priv->sink)
+        _priv->sink->on_chunk_write (*this, buffer, nbytes);
+    if (!_priv->signal_write.empty ())
+        _priv->signal_write (*this, buffer, nbytes);
+    _priv->current_pos += nbytes;
+    if (_priv->current_pos > _priv->target_pos)
+        stop ();
+}
+
+bool
+Chunk::signal_copy (int fd, size_t nbytes)
+{
+    YATTA_TRACE_SCOPE ("Chunk::signal_copy");
+    bool copied = _priv->sink &&
+        _priv->sink->on_chunk_copy (*this, fd, nbytes);
+    if (!copied && !_priv->signal_copy.empty ())
+        copied = _priv->signal_copy (*this, fd, nbytes);
+    if (!copied)
+        return false;
+
     _priv->current_pos += nbytes;
     if (_priv->current_pos > _priv->target_pos)
         stop ();
+    return true;
+}
+
+void
+Chunk::signal_headers ()
+{
+    _priv->signal_headers (shared_from_this ());
 }
 
 void
 Chunk::signal_started ()
 {
     _priv->running = true;
+    _priv->failure = NONE;
     _priv->signal_started (shared_from_this ());
 }
 
@@ -19,7 +19,7 @@
 #ifndef YATTA_CHUNK_H
 #define YATTA_CHUNK_H
 
-#include <tr1/memory>
+#include <memory>
 #include <sigc++/sigc++.h>
 #include <string>
 #include <exception>
@@ -27,32 +27,42 @@
 namespace Yatta
 {
     class ChunkFactory;
-    typedef std::tr1::shared_ptr<ChunkFactory> ChunkFactoryPtr;
-    typedef std::tr1::shared_ptr<ChunkFactory> ChunkFactoryWPtr;
+    class ChunkSink;
+    typedef std::shared_ptr<ChunkFactory> ChunkFactoryPtr;
+    typedef std::shared_ptr<ChunkFactory> ChunkFactoryWPtr;
 
-    class Chunk : protected std::tr1::enable_shared_from_this <Chunk>
+    class Chunk : public std::enable_shared_from_this <Chunk>
     {
     public:
-        typedef std::tr1::shared_ptr<Chunk> Ptr;
-        typedef std::tr1::weak_ptr<Chunk> WPtr;
+        typedef std::shared_ptr<Chunk> Ptr;
+        typedef std::weak_ptr<Chunk> WPtr;
 
-        // factory paradigm
+        // factory paradigm. the most recently registered factory for
+        // the URL's scheme wins, or failing that, the most recently
+        // registered one of all. a factory registered without a scheme
+        // takes every scheme
         static Ptr create (const std::string &url,
                            size_t offset,
                            size_t size = 0);
         static void register_factory (ChunkFactoryPtr factory);
+        static void register_factory (const std::string &scheme,
+                                      ChunkFactoryPtr factory);
 
         virtual void start () = 0;
         virtual void stop () = 0;
         void reset ();
 
+        // stop taking in data for a while without dropping the connection
+        virtual void pause () = 0;
+        virtual void resume () = 0;
+
         class Unmergeable : public std::exception
         {
         public:
             Unmergeable () {}
-            virtual ~Unmergeable () throw () {}
+            virtual ~Unmergeable () noexcept {}
 
-            virtual const char* what() const throw()
+            virtual const char* what () const noexcept
             { return "Could not merge chunks"; }
 
         private:
@@ -61,69 +71,149 @@ namespace Yatta
 
         void merge (Ptr previous_chunk);
 
+        // why a chunk last finished short of its target
+        enum Failure
+        {
+            NONE,       // it didn't, or nobody knows
+            STOPPED,    // stop () was called from inside a callback
+            TIMEOUT,    // the server went quiet
+            CONNECTION, // couldn't connect, or the connection dropped
+            THROTTLED,  // told to slow down (429, 503)
+            SERVER,     // any other 5xx
+            REFUSED,    // 4xx, or the file isn't there: asking again won't
+                        // help
+            BAD_RANGE   // 416, or the range was ignored
+        };
+
         // accessors
         bool running () const;
+        bool paused () const;
         virtual bool resumable () const = 0;
 
+        // reset to NONE by each start ()
+        Failure failure () const;
+
         size_t offset () const;
         size_t target_pos () const;
         size_t current_pos () const;
         size_t size () const { return target_pos () - offset (); }
         virtual size_t content_length() const = 0;
 
+        // size of the whole remote file, 0 if unknown. only meaningful
+        // once signal_headers has fired
+        virtual size_t total_size () const = 0;
+
+        // name the server would like the file saved under, if it said
+        virtual std::string suggested_filename () const
+        { return std::string (); }
+
+        // how the server encoded what it's sending (gzip and so on),
+        // empty for as is. only meaningful once signal_headers has fired
+        virtual std::string content_encoding () const
+        { return std::string (); }
+
+        // ask for the data compressed, with an Accept-Encoding list.
+        // empty, the default, asks for it as is. a compressed answer is
+        // only any use for the whole file, so offsets and sizes are then
+        // those of the compressed data
+        std::string accept_encoding () const;
+        void accept_encoding (const std::string &encodings);
+
         std::string url () const;
 
         // setters
-        void target_pos (size_t) const;
+        void target_pos (size_t);
+
+        // gets every write and copy before the slots below do. not
+        // owned: unset it before the sink goes away
+        ChunkSink *sink () const;
+        void sink (ChunkSink *sink);
 
-        // signals
-        typedef sigc::slot<void, Ptr,
+        // signals. sink () is cheaper for whoever takes the data; the
+        // per-buffer ones pass the chunk by reference all the same
+        typedef sigc::slot<void, Chunk &,
                            void * /* buffer */,
                            size_t /* nbytes */> WriteSlot;
+        typedef sigc::slot<void, Ptr> HeadersSlot;
         typedef sigc::slot<void, Ptr> StartedSlot;
         typedef sigc::slot<void, Ptr> StoppedSlot;
         typedef sigc::slot<void, Ptr> ResetSlot;
         typedef sigc::slot<void, Ptr> FinishedSlot;
 
+        // chunks reading a local file offer it here first, so that it
+        // can be copied in the kernel. the slot reads nbytes from fd at
+        // current_pos () and returns true, or returns false to be
+        // handed buffers through signal_write instead
+        typedef sigc::slot<bool, Chunk &,
+                           int /* fd */,
+                           size_t /* nbytes */> CopySlot;
+
         sigc::connection connect_signal_write (WriteSlot slot);
+        sigc::connection connect_signal_copy (CopySlot slot);
+        sigc::connection connect_signal_headers (HeadersSlot slot);
         sigc::connection connect_signal_started (StartedSlot slot);
         sigc::connection connect_signal_stopped (StoppedSlot slot);
         sigc::connection connect_signal_finished (FinishedSlot slot);
 
-        virtual ~Chunk () {}
+        virtual ~Chunk ();
 
     protected:
         Chunk (const std::string &url,
                size_t offset,
                size_t size);
 
+        void paused (bool paused);
+        void failure (Failure failure);
+
         // functions called by derivatives to fire signals
         void signal_write (void *buffer, size_t nbytes);
+        bool signal_copy (int fd, size_t nbytes);
+        void signal_headers ();
         void signal_started ();
         void signal_stopped ();
         void signal_reset ();
         void signal_finished ();
 
     private:
-        Chunk (const Chunk &);  // no copying
+        Chunk (const Chunk &) = delete;
 
         struct Private;
         friend class Private;
 
-        std::tr1::shared_ptr<Private> _priv;
+        std::unique_ptr<Private> _priv;
     };
 
     typedef Chunk::Ptr ChunkPtr;
 
 
+    // the receiving end of a chunk's data. one virtual call per buffer,
+    // without the slot list or a shared_ptr to go with it
+    class ChunkSink
+    {
+    public:
+        virtual ~ChunkSink () {}
+
+        virtual void on_chunk_write (Chunk &chunk,
+                                     void *buffer,
+                                     size_t nbytes) = 0;
+
+        // see Chunk::CopySlot
+        virtual bool on_chunk_copy (Chunk &, int /* fd */,
+                                    size_t /* nbytes */)
+        { return false; }
+    };
+
+
     class ChunkFactory
     {
     public:
         typedef ChunkFactoryPtr Ptr;
         typedef ChunkFactoryWPtr WPtr;
 
-        virtual ~ChunkFactory () throw () {}
-        virtual ChunkPtr create_chunk () = 0;
+        virtual ~ChunkFactory () noexcept {}
+        virtual ChunkPtr create_chunk (const std::string &url,
+                                       size_t offset,
+                                       size_t size) = 0;
     };
 }
 
@@ -18,48 +18,124 @@
 #include <sstream>
 #include <limits>
 #include <algorithm>
+#include <cstdlib>
+#include <strings.h>
 
 #include <sigc++/signal.h>
 
 #include "chunk.hh"
 #include "../download.hh"
 #include "manager.hh"
+#include "../hostinfo.hh"
+#include "../filename.hh"
+#include "../pool.hh"
 
 
 using Yatta::Curl::Chunk;
 typedef ::Yatta::Chunk IChunk;
 
 // first the private class implementation
-struct Chunk::Private
+struct Chunk::Private : Yatta::Pooled<Chunk::Private>
 {
     // constructor
     Private () :
         handle (NULL),
         headers (NULL),
+        connect_to (NULL),
+        address (),
+        started_at (0),
+        started_pos (0),
         in_curl_callback (false),
-        stop_queued (false)
+        stop_queued (false),
+        total_size (0),
+        http (true),
+        answered (false),
+        ranged (true),
+        accepts_ranges (false)
     {}
 
     // data
     CURL       *handle;
     curl_slist *headers;
+
+    // where this connection was sent by Manager::pick_address, and how
+    // far it's got since, to tell the Manager how well it went
+    curl_slist *connect_to;
+    std::string address;
+    gint64      started_at;
+    size_t      started_pos;
+
     bool        in_curl_callback;
     bool        stop_queued;
+    size_t      total_size;
+
+    // FTP and SFTP have no headers to speak of, so signal_headers comes
+    // with the first data instead
+    bool        http;
+    bool        answered;
+    std::string suggested_filename;
+
+    // asking for a compressed whole file goes without a range. a plain
+    // answer to that can still be split, if the server takes ranges
+    bool        ranged;
+    bool        accepts_ranges;
+    std::string content_encoding;
 
     // write function
     static size_t on_curl_write (void *data, size_t size,
                                  size_t nmemb, void *obj);
+    static size_t on_curl_header (char *data, size_t size,
+                                  size_t nmemb, void *obj);
 };
 
 // Exception safe method of marking in_curl_callback as true
 namespace {
+    // what went wrong, as far as trying again is concerned
+    IChunk::Failure classify (CURLcode result, long code)
+    {
+        if (result == CURLE_HTTP_RETURNED_ERROR || code >= 400) {
+            if (code == 416)
+                return IChunk::BAD_RANGE;
+            if (code == 429 || code == 503)
+                return IChunk::THROTTLED;
+            if (code >= 500)
+                return IChunk::SERVER;
+            if (code >= 400)
+                return IChunk::REFUSED;
+        }
+
+        switch (result) {
+        case CURLE_OK:
+            // the server closed early without saying anything
+            return IChunk::CONNECTION;
+
+        case CURLE_OPERATION_TIMEDOUT:
+            return IChunk::TIMEOUT;
+
+        case CURLE_RANGE_ERROR:
+            return IChunk::BAD_RANGE;
+
+        case CURLE_UNSUPPORTED_PROTOCOL:
+        case CURLE_URL_MALFORMAT:
+        case CURLE_REMOTE_ACCESS_DENIED:
+        case CURLE_LOGIN_DENIED:
+        case CURLE_REMOTE_FILE_NOT_FOUND:
+            return IChunk::REFUSED;
+
+        default:
+            return IChunk::CONNECTION;
+        }
+    }
+
     class BoolLock
     {
     public:
         BoolLock (bool &flag) :
             flag (flag),
             owns_flag (!flag)
-        {}
+        {
+            flag = true;
+        }
 
         ~BoolLock ()
         {
@@ -94,27 +170,70 @@ void Chunk::start ()
     if (running ())
         return;
 
-    // create chunk
-    _priv->handle = curl_easy_init ();
+    // a pause from before the last stop has nothing left to wait for,
+    // and nothing would come along to lift it
+    paused (false);
+
+    // a recycled handle keeps its connections and DNS cache
+    _priv->handle = Manager::get ()->acquire_handle ();
     curl_easy_setopt (handle (), CURLOPT_URL,
                       url ().c_str ());
-    curl_easy_setopt (handle (), CURLOPT_RESUME_FROM, current_pos ());
-
-    // hack to tell libcurl to pass the range anyway to induce a 206
-    if (current_pos () == 0) {
-        std::ostringstream ss;
-        ss << "Range: bytes=" << current_pos () << "-";
-        _priv->headers = curl_slist_append (_priv->headers, ss.str ().c_str ());
+    curl_easy_setopt (handle (), CURLOPT_FOLLOWLOCATION, 1L);
+
+    // an error page is no part of the file; end with the status instead
+    curl_easy_setopt (handle (), CURLOPT_FAILONERROR, 1L);
+
+    // always send a range, even from 0, to induce a 206. bound it when we
+    // know where to stop so that the server doesn't send more than we
+    // want and the connection can be reused afterwards. the exception is
+    // the whole file, compressed: most servers won't compress a range
+    _priv->ranged = accept_encoding ().empty () || current_pos () > 0 ||
+        target_pos () != std::numeric_limits<size_t>::max ();
+    if (_priv->ranged) {
+        std::ostringstream range;
+        range << current_pos () << "-";
+        if (target_pos () != std::numeric_limits<size_t>::max ())
+            range << target_pos () - 1;
+        curl_easy_setopt (handle (), CURLOPT_RANGE, range.str ().c_str ());
+    }
 
+    // spelt out rather than CURLOPT_ACCEPT_ENCODING, which would have
+    // curl decode it here on the main loop
+    if (!accept_encoding ().empty ()) {
+        _priv->headers = curl_slist_append
+            (_priv->headers,
+             ("Accept-Encoding: " + accept_encoding ()).c_str ());
         curl_easy_setopt (handle (), CURLOPT_HTTPHEADER, _priv->headers);
     }
 
+    // spread the chunks of a host with many addresses over them. the
+    // Host header and certificate checks still go by the name
+#if LIBCURL_VERSION_NUM >= 0x073100
+    _priv->address = Manager::get ()->pick_address (url ());
+    if (!_priv->address.empty ()) {
+        _priv->connect_to = curl_slist_append (NULL,
+                                               _priv->address.c_str ());
+        curl_easy_setopt (handle (), CURLOPT_CONNECT_TO, _priv->connect_to);
+    }
+#endif
+    _priv->started_at = g_get_monotonic_time ();
+    _priv->started_pos = current_pos ();
+
+    _priv->total_size = 0;
+    _priv->http = g_ascii_strncasecmp (url ().c_str (), "http", 4) == 0;
+    _priv->answered = false;
+    _priv->accepts_ranges = false;
+    _priv->content_encoding.clear ();
+
     // make curl pass this into the callbacks
     curl_easy_setopt (handle (), CURLOPT_WRITEDATA, this);
+    curl_easy_setopt (handle (), CURLOPT_HEADERDATA, this);
 
     // bind the callbacks
     curl_easy_setopt (handle (), CURLOPT_WRITEFUNCTION,
                       &Private::on_curl_write);
+    curl_easy_setopt (handle (), CURLOPT_HEADERFUNCTION,
+                      &Private::on_curl_header);
 
 
     Manager::get ()->add_handle (this);
@@ -135,34 +254,115 @@ void Chunk::stop ()
     }
 
     Manager::get ()->remove_handle (this);
-    curl_easy_cleanup (_priv->handle);
+    Manager::get ()->release_handle (_priv->handle);
     curl_slist_free_all (_priv->headers);
+    curl_slist_free_all (_priv->connect_to);
+
+    if (!_priv->address.empty ())
+        Manager::get ()->address_done
+            (url (), _priv->address, current_pos () - _priv->started_pos,
+             (g_get_monotonic_time () - _priv->started_at) / 1e6,
+             failure () == CONNECTION || failure () == TIMEOUT);
 
     _priv->handle = NULL;
     _priv->headers = NULL;
+    _priv->connect_to = NULL;
+    _priv->address.clear ();
     _priv->stop_queued = false;
 
     signal_stopped ();
 }
 
+void Chunk::pause ()
+{
+    if (paused ())
+        return;
+
+    paused (true);
+
+    // from inside the write callback, returning CURL_WRITEFUNC_PAUSE on
+    // the next write does the job. otherwise stop reading the socket now
+    if (running () && !_priv->in_curl_callback)
+        curl_easy_pause (handle (), CURLPAUSE_RECV);
+}
+
+void Chunk::resume ()
+{
+    if (!paused ())
+        return;
+
+    paused (false);
+
+    // this may deliver buffered data through on_curl_write right away
+    if (running ())
+        curl_easy_pause (handle (), CURLPAUSE_CONT);
+}
+
 bool Chunk::resumable () const
 {
+    // curl fails the transfer if it can't honour a range over FTP or
+    // SFTP, so getting this far means it did
+    if (!_priv->http)
+        return _priv->total_size > 0;
+
+    // compressed data has to be decoded in order from the start, so
+    // it can't be split up, whatever the server says about ranges
+    if (!_priv->content_encoding.empty ())
+        return false;
+
     long code;
     curl_easy_getinfo (_priv->handle, CURLINFO_RESPONSE_CODE, &code);
-    return (code == 206);
+    return code == 206 ||
+        (code == 200 && !_priv->ranged && _priv->accepts_ranges);
 }
 
 size_t Chunk::content_length() const
 {
-    long code;
-    curl_easy_getinfo (_priv->handle, CURLINFO_RESPONSE_CODE, &code);
-    return (code == 206);
+    // -1 means that the server didn't tell us
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t length;
+    curl_easy_getinfo (_priv->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                       &length);
+#else
+    double length;
+    curl_easy_getinfo (_priv->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                       &length);
+#endif
+
+    return length < 0 ? 0 : static_cast<size_t> (length);
 }
 
-void Chunk::stop_finished (CURLcode)
+size_t Chunk::total_size () const
 {
-    long code;
+    return _priv->total_size;
+}
+
+std::string Chunk::suggested_filename () const
+{
+    return _priv->suggested_filename;
+}
+
+std::string Chunk::content_encoding () const
+{
+    return _priv->content_encoding;
+}
+
+void Chunk::stop_finished (CURLcode result)
+{
+    long code = 0;
     curl_easy_getinfo (handle (), CURLINFO_RESPONSE_CODE, &code);
+
+    // remember hosts which tell us to slow down
+    if (code == 429 || code == 503)
+        HostInfo::get ().throttled (url ());
+
+    if (_priv->stop_queued)
+        failure (STOPPED);
+    else if (failure () == NONE && current_pos () < target_pos () &&
+             (result != CURLE_OK || target_pos () !=
+              std::numeric_limits<size_t>::max ()))
+        failure (classify (result, code));
+
     stop ();
 
     signal_finished ();
@@ -179,6 +379,17 @@ const CURL *Chunk::handle () const
     return _priv->handle;
 }
 
+// factory
+Yatta::ChunkPtr
+Yatta::Curl::ChunkFactory::create_chunk (const std::string &url,
+                                         size_t offset,
+                                         size_t size)
+{
+    // the chunk and its reference count in one block, from the pool
+    return std::allocate_shared<Chunk> (Yatta::PoolAllocator<Chunk> (),
+                                        url, offset, size);
+}
+
 // static CURL callbacks
 size_t Chunk::Private::on_curl_write (void *data, size_t size,
                                       size_t nmemb, void *obj)
@@ -187,14 +398,123 @@ size_t Chunk::Private::on_curl_write (void *data, size_t size,
 
     // we're stopped, so don't do anything
     if (self->_priv->stop_queued ||
-        self->target_pos () >= self->current_pos ())
+        self->current_pos () >= self->target_pos ())
         return 0;
 
+    // without headers, the size is known once the transfer starts. a
+    // bounded range only tells us about itself, so it says nothing
+    if (!self->_priv->http && !self->_priv->answered &&
+        self->target_pos () == std::numeric_limits<size_t>::max ()) {
+        self->_priv->answered = true;
+        self->_priv->total_size =
+            self->current_pos () + self->content_length ();
+
+        BoolLock callback_lock (self->_priv->in_curl_callback);
+        self->signal_headers ();
+        if (self->_priv->stop_queued)
+            return 0;
+    }
+
+    // curl will hand the same data over again once we're resumed
+    if (self->paused ())
+        return CURL_WRITEFUNC_PAUSE;
+
     size_t bytes_handled = std::min (self->target_pos () - self->current_pos (),
                                      size * nmemb);
 
-    BoolLock callback_lock = BoolLock (self->_priv->in_curl_callback);
+    BoolLock callback_lock (self->_priv->in_curl_callback);
     self->signal_write (data, bytes_handled);
 
     return bytes_handled;
 }
+
+size_t Chunk::Private::on_curl_header (char *data, size_t size,
+                                       size_t nmemb, void *obj)
+{
+    Chunk *self = reinterpret_cast<Chunk*> (obj);
+    size_t bytes = size * nmemb;
+
+    // FTP server chatter
+    if (!self->_priv->http)
+        return bytes;
+
+    std::string line (data, bytes);
+
+    // a new response (after a redirect or a 100 Continue) starts afresh
+    if (line.compare (0, 5, "HTTP/") == 0) {
+        self->_priv->total_size = 0;
+        self->_priv->suggested_filename.clear ();
+        self->_priv->accepts_ranges = false;
+        self->_priv->content_encoding.clear ();
+        return bytes;
+    }
+
+    if (strncasecmp (line.c_str (), "Content-Encoding:", 17) == 0) {
+        size_t start = line.find_first_not_of (" \t", 17);
+        size_t end = line.find_last_not_of (" \t\r\n");
+        if (start != std::string::npos && end >= start)
+            self->_priv->content_encoding =
+                line.substr (start, end - start + 1);
+        if (strcasecmp (self->_priv->content_encoding.c_str (),
+                        "identity") == 0)
+            self->_priv->content_encoding.clear ();
+        return bytes;
+    }
+
+    if (strncasecmp (line.c_str (), "Accept-Ranges:", 14) == 0) {
+        self->_priv->accepts_ranges =
+            line.find ("bytes", 14) != std::string::npos;
+        return bytes;
+    }
+
+    if (strncasecmp (line.c_str (), "Content-Disposition:", 20) == 0) {
+        self->_priv->suggested_filename =
+            Filename::from_content_disposition (line.substr (20));
+        return bytes;
+    }
+
+    // Content-Range: bytes <first>-<last>/<total>
+    if (strncasecmp (line.c_str (), "Content-Range:", 14) == 0) {
+        size_t slash = line.find ('/');
+        if (slash != std::string::npos && line[slash + 1] != '*')
+            self->_priv->total_size =
+                std::strtoul (line.c_str () + slash + 1, NULL, 10);
+        return bytes;
+    }
+
+    // anything but the blank line ending the headers is of no interest
+    if (line != "\r\n" && line != "\n")
+        return bytes;
+
+    long code;
+    curl_easy_getinfo (self->handle (), CURLINFO_RESPONSE_CODE, &code);
+
+    // interim responses and redirects being followed. errors aren't an
+    // answer either; the chunk will end and be dealt with then
+    if (code < 200 || code >= 300)
+        return bytes;
+
+    // the server ignored our range, so the data would land in the wrong
+    // place
+    if (self->current_pos () > 0 && code != 206) {
+        self->failure (BAD_RANGE);
+        return 0;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x073200
+    long version;
+    curl_easy_getinfo (self->handle (), CURLINFO_HTTP_VERSION, &version);
+    if (version != 0)
+        HostInfo::get ().http2 (self->url (),
+                                version >= CURL_HTTP_VERSION_2_0);
+#endif
+
+    // a plain 200 carries the whole file
+    if (code == 200 && self->_priv->total_size == 0)
+        self->_priv->total_size = self->content_length ();
+
+    BoolLock callback_lock (self->_priv->in_curl_callback);
+    self->signal_headers ();
+
+    return bytes;
+}
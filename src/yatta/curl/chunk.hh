@@ -18,7 +18,7 @@
 #ifndef YATTA_CURL_CHUNK_H
 #define YATTA_CURL_CHUNK_H
 
-#include <tr1/memory>
+#include <memory>
 
 #include <curl/curl.h>
 #include <sigc++/slot.h>
@@ -42,9 +42,14 @@ namespace Yatta
 
             virtual void start ();
             virtual void stop ();
+            virtual void pause ();
+            virtual void resume ();
 
             virtual bool resumable () const;
             virtual size_t content_length() const;
+            virtual size_t total_size () const;
+            virtual std::string suggested_filename () const;
+            virtual std::string content_encoding () const;
 
             // stop the chunk because it has finished (will emit
             // signal_finished)
@@ -56,7 +61,16 @@ namespace Yatta
         private:
             struct Private;
             friend class Private;
-            std::tr1::shared_ptr<Private> _priv;
+            std::unique_ptr<Private> _priv;
+        };
+
+        class ChunkFactory : public ::Yatta::ChunkFactory
+        {
+        public:
+            virtual ~ChunkFactory () noexcept {}
+            virtual ChunkPtr create_chunk (const std::string &url,
+                                           size_t offset,
+                                           size_t size);
         };
     }
 }
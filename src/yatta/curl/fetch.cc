@@ -0,0 +1,305 @@
+/* fetch.cc -- single request downloads of small files
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <strings.h>
+
+#include <sigc++/bind.h>
+#include <sigc++/signal.h>
+#include <glibmm/main.h>
+#include <glibmm/miscutils.h>
+
+#include "fetch.hh"
+#include "manager.hh"
+#include "../hostinfo.hh"
+#include "../filename.hh"
+#include "../workerpool.hh"
+
+using Yatta::Curl::Fetch;
+
+namespace
+{
+    typedef std::shared_ptr<std::vector<char> > BodyPtr;
+
+    // runs on the WorkerPool
+    void save_file (std::string dirname, std::string path, BodyPtr body,
+                    int *error)
+    {
+        *error = 0;
+
+        if (g_mkdir_with_parents (dirname.c_str (), 0755) != 0) {
+            *error = errno;
+            return;
+        }
+
+        int fd = open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            *error = errno;
+            return;
+        }
+
+        const char *data = body->empty () ? "" : &(*body)[0];
+        size_t size = body->size ();
+        while (size > 0) {
+            ssize_t written = write (fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                *error = errno;
+                close (fd);
+                return;
+            }
+
+            data += written;
+            size -= written;
+        }
+
+        if (close (fd) != 0)
+            *error = errno;
+    }
+}
+
+struct Fetch::Private
+{
+    // through the Manager, which sets curl up globally before the first
+    // easy handle exists
+    Private (size_t max_size) :
+        handle (Manager::get ()->acquire_handle ()),
+        max_size (max_size),
+        running (false),
+        saving (false),
+        too_big (false),
+        error (0)
+    {}
+
+    ~Private ()
+    {
+        Manager::get ()->release_handle (handle);
+    }
+
+    CURL                           *handle;
+    size_t                          max_size;
+    bool                            running;
+    bool                            saving;
+    bool                            too_big;
+    int                             error;
+    std::string                     url;
+    std::string                     dirname;
+    std::string                     filename;
+    std::string                     path;
+    BodyPtr                         body;
+    sigc::signal<void, Result>      signal_finished;
+
+    static size_t on_curl_write (void *data, size_t size,
+                                 size_t nmemb, void *obj);
+    static size_t on_curl_header (char *data, size_t size,
+                                  size_t nmemb, void *obj);
+};
+
+Fetch::Fetch (size_t max_size) :
+    sigc::trackable (),
+    _priv (new Private (max_size))
+{
+    CURL *handle = _priv->handle;
+
+    curl_easy_setopt (handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (handle, CURLOPT_FAILONERROR, 1L);
+
+    curl_easy_setopt (handle, CURLOPT_WRITEDATA, _priv.get ());
+    curl_easy_setopt (handle, CURLOPT_HEADERDATA, _priv.get ());
+    curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
+                      &Private::on_curl_write);
+    curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
+                      &Private::on_curl_header);
+}
+
+Fetch::~Fetch ()
+{
+    stop ();
+
+    // the save job writes into _priv
+    Glib::RefPtr<Glib::MainContext> context =
+        Glib::MainContext::get_default ();
+    while (_priv->saving)
+        context->iteration (true);
+}
+
+void Fetch::start (const std::string &url, const std::string &dirname)
+{
+    stop ();
+
+    _priv->url = url;
+    _priv->dirname = dirname;
+    _priv->filename.clear ();
+    _priv->too_big = false;
+
+    // the last body may still be on its way to disk
+    _priv->body.reset (new std::vector<char>);
+
+    // the rest of the options stay as they were for the last fetch
+    curl_easy_setopt (_priv->handle, CURLOPT_URL, _priv->url.c_str ());
+
+    _priv->running = true;
+    Manager::get ()->add_handle (_priv->handle, url,
+                                 sigc::mem_fun (*this, &Fetch::on_done));
+}
+
+void Fetch::stop ()
+{
+    if (!_priv->running || _priv->saving)
+        return;
+
+    Manager::get ()->remove_handle (_priv->handle);
+    _priv->running = false;
+    _priv->body.reset ();
+}
+
+bool Fetch::running () const
+{
+    return _priv->running;
+}
+
+size_t Fetch::max_size () const
+{
+    return _priv->max_size;
+}
+
+sigc::connection Fetch::connect_signal_finished (const FinishedSlot &slot)
+{
+    return _priv->signal_finished.connect (slot);
+}
+
+void Fetch::on_done (CURLcode code)
+{
+    Manager::get ()->remove_handle (_priv->handle);
+
+    Result result;
+    if (_priv->too_big)
+        result = TOO_BIG;
+    else if (code != CURLE_OK) {
+        long response;
+        curl_easy_getinfo (_priv->handle, CURLINFO_RESPONSE_CODE, &response);
+        if (response == 429 || response == 503)
+            HostInfo::get ().throttled (_priv->url);
+
+        result = FAILED;
+    } else {
+        // the one write happens off the main loop
+        std::string name = _priv->filename.empty () ?
+            Filename::from_url (_priv->url) : _priv->filename;
+        _priv->path = Glib::build_filename (_priv->dirname, name);
+        _priv->saving = true;
+
+        WorkerPool::get ().push
+            (sigc::bind (sigc::ptr_fun (&save_file), _priv->dirname,
+                         _priv->path, _priv->body, &_priv->error),
+             sigc::mem_fun (*this, &Fetch::on_saved));
+        return;
+    }
+
+    _priv->running = false;
+    _priv->body.reset ();
+    _priv->signal_finished (result);
+}
+
+void Fetch::on_saved ()
+{
+    _priv->saving = false;
+    _priv->running = false;
+    _priv->body.reset ();
+
+    if (_priv->error)
+        g_warning ("Could not save %s: %s", _priv->path.c_str (),
+                   g_strerror (_priv->error));
+
+    _priv->signal_finished (_priv->error ? FAILED : DONE);
+}
+
+size_t Fetch::Private::on_curl_write (void *data, size_t size,
+                                      size_t nmemb, void *obj)
+{
+    Private *self = static_cast<Private *> (obj);
+    size_t bytes = size * nmemb;
+
+    // servers that don't send a Content-Length end up here
+    if (self->body->size () + bytes > self->max_size) {
+        self->too_big = true;
+        return 0;
+    }
+
+    const char *begin = static_cast<const char *> (data);
+    self->body->insert (self->body->end (), begin, begin + bytes);
+
+    return bytes;
+}
+
+size_t Fetch::Private::on_curl_header (char *data, size_t size,
+                                       size_t nmemb, void *obj)
+{
+    Private *self = static_cast<Private *> (obj);
+    size_t bytes = size * nmemb;
+
+    // a new response (after a redirect) starts afresh
+    if (bytes >= 5 && strncmp (data, "HTTP/", 5) == 0) {
+        self->filename.clear ();
+        return bytes;
+    }
+
+    if (bytes > 20 && strncasecmp (data, "Content-Disposition:", 20) == 0) {
+        self->filename = Filename::from_content_disposition
+            (std::string (data + 20, bytes - 20));
+        return bytes;
+    }
+
+    // anything but the blank line ending the headers is of no interest
+    if (bytes > 2 || (data[0] != '\r' && data[0] != '\n'))
+        return bytes;
+
+    long code;
+    curl_easy_getinfo (self->handle, CURLINFO_RESPONSE_CODE, &code);
+    if (code < 200 || code >= 300)
+        return bytes;
+
+    // -1 means that the server didn't tell us
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t length;
+    curl_easy_getinfo (self->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                       &length);
+#else
+    double length;
+    curl_easy_getinfo (self->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                       &length);
+#endif
+
+    if (length > 0 && static_cast<size_t> (length) > self->max_size) {
+        self->too_big = true;
+        return 0;
+    }
+
+    if (length > 0)
+        self->body->reserve (static_cast<size_t> (length));
+
+    return bytes;
+}
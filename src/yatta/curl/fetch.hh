@@ -0,0 +1,83 @@
+/* fetch.hh -- single request downloads of small files
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_CURL_FETCH_H
+#define YATTA_CURL_FETCH_H
+
+#include <memory>
+#include <string>
+
+#include <curl/curl.h>
+#include <sigc++/trackable.h>
+#include <sigc++/connection.h>
+#include <sigc++/slot.h>
+
+namespace Yatta
+{
+    namespace Curl
+    {
+        /**
+         * @brief: Fetches a whole file with one request and one write
+         *
+         * The body is kept in memory and written out on the WorkerPool
+         * when the transfer is over. Anything bigger than max_size () is
+         * abandoned as soon as we know, so that the caller can fall back
+         * to a Download. One easy handle serves every fetch, and since it
+         * runs on the Manager's multi handle, connections left open by
+         * earlier transfers get reused.
+         */
+        class Fetch : public sigc::trackable
+        {
+        public:
+            enum Result
+            {
+                DONE,
+                TOO_BIG,
+                FAILED
+            };
+
+            typedef sigc::slot<void, Result> FinishedSlot;
+
+            explicit Fetch (size_t max_size);
+            ~Fetch ();
+
+            // fetch url into dirname, replacing any file of the same
+            // name. the name comes from Content-Disposition or the URL
+            void start (const std::string &url, const std::string &dirname);
+            void stop ();
+
+            bool running () const;
+            size_t max_size () const;
+
+            sigc::connection
+            connect_signal_finished (const FinishedSlot &slot);
+
+        private:
+            Fetch (const Fetch &) = delete;
+
+            void on_done (CURLcode result);
+            void on_saved ();
+
+            struct Private;
+            friend struct Private;
+            std::unique_ptr<Private> _priv;
+        };
+    }
+}
+
+#endif // YATTA_CURL_FETCH_H
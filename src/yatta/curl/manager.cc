@@ -18,20 +18,87 @@
 #include <iostream>
 #include <queue>
 #include <map>
+#include <vector>
 
 #include <glibmm/dispatcher.h>
+#include <giomm/resolver.h>
+#include <giomm/inetaddress.h>
 
 #include "manager.hh"
 #include "chunk.hh"
+#include "../metrics.hh"
+#include "../hostinfo.hh"
+#include "../trace.hh"
 
 namespace Yatta
 {
     namespace Curl
     {
-        typedef std::tr1::shared_ptr<Glib::PollFD> pollptr_t;
-        typedef std::map<CURL*, Chunk*> chunkmap_t;
+        typedef std::shared_ptr<Glib::PollFD> pollptr_t;
+        struct Transfer
+        {
+            std::string       url;
+            Manager::DoneSlot done;
+        };
+
+        typedef std::map<CURL*, Transfer> chunkmap_t;
         typedef std::map<curl_socket_t, pollptr_t> pollmap_t;
 
+        // one of the addresses a host resolved to
+        struct Address
+        {
+            std::string ip;
+            unsigned    connections;    // running through it now
+            bool        measured;       // has throughput been seen yet
+            double      throughput;     // per connection, bytes/s
+        };
+
+        // addresses of each host:port; empty until resolved
+        typedef std::map<std::string, std::vector<Address> > hostmap_t;
+
+        namespace
+        {
+            // connections shorter than this say more about latency than
+            // about the address
+            const double min_measured_time = 1.0;
+
+            // weight of the newest measurement in an address' average
+            const double throughput_weight = 0.3;
+
+            // host and port of url, for resolving and CURLOPT_CONNECT_TO.
+            // false for IP literals and anything else not worth resolving
+            bool split_origin (const std::string &url,
+                               std::string &host, std::string &port)
+            {
+                std::string origin = HostInfo::origin (url);
+                size_t start = origin.find ("://");
+                if (start == std::string::npos)
+                    return false;
+
+                std::string scheme = origin.substr (0, start);
+                host = origin.substr (start + 3);
+                if (host.empty () || host[0] == '[')
+                    return false;
+
+                size_t colon = host.rfind (':');
+                if (colon != std::string::npos) {
+                    port = host.substr (colon + 1);
+                    host.erase (colon);
+                } else if (scheme == "http")
+                    port = "80";
+                else if (scheme == "https")
+                    port = "443";
+                else if (scheme == "ftp")
+                    port = "21";
+                else
+                    return false;
+
+                return !host.empty () &&
+                    host.find_first_not_of ("0123456789.") !=
+                    std::string::npos;
+            }
+        }
+
         struct Manager::Private
         {
             Private () :
@@ -40,22 +107,31 @@ namespace Yatta
                 running_handles (0),
                 chunkmap (),
                 pollmap (),
-                active_fds ()
+                active_fds (),
+                idle_handles (),
+                hosts ()
                 {}
 
             CURLM *multihandle; // only multi handle which will be used
             CURLSH *sharehandle; // to share data between easy handles
 
             int running_handles; // number of running handles
-            chunkmap_t chunkmap; // map of CURL* to Chunk ptrs
+            chunkmap_t chunkmap; // map of CURL* to whoever's running it
             pollmap_t pollmap; // map of curl sockets to PollFD structs
             std::queue<pollptr_t> active_fds;
+            std::vector<CURL *> idle_handles; // reset, ready for reuse
+            hostmap_t hosts; // by host:port
+
+            void on_resolved (Glib::RefPtr<Gio::AsyncResult> &result,
+                              std::string key, std::string host);
 
             static Glib::RefPtr<Manager> instance; // singleton instance
         };
 
         Glib::RefPtr<Manager> Manager::Private::instance;
 
+        const size_t Manager::max_idle_handles;
+
         Manager::Manager () :
             Glib::Source (),
             _priv (new Private())
@@ -79,16 +155,29 @@ namespace Yatta
                              (sigc::mem_fun (*this, &Manager::dispatch)));
         }
 
+        void Manager::install ()
+        {
+            ::Yatta::Chunk::register_factory
+                  (ChunkFactoryPtr (new ChunkFactory));
+        }
+
         Glib::RefPtr<Manager> Manager::get ()
         {
-            if (!Private::instance)
+            if (!Private::instance) {
                 Private::instance = Glib::RefPtr<Manager> (new Manager);
+                Private::instance->attach ();
+            }
 
             return Private::instance;
         }
 
         Manager::~Manager ()
         {
+            for (std::vector<CURL *>::iterator i =
+                     _priv->idle_handles.begin ();
+                 i != _priv->idle_handles.end (); ++i)
+                curl_easy_cleanup (*i);
+
             curl_multi_cleanup (_priv->multihandle);
             curl_share_cleanup (_priv->sharehandle);
             curl_global_cleanup ();
@@ -96,20 +185,177 @@ namespace Yatta
 
         void Manager::add_handle (Chunk *chunk)
         {
-            CURL *handle = chunk->handle ();
+            add_handle (chunk->handle (), chunk->url (),
+                        sigc::mem_fun (*chunk, &Chunk::stop_finished));
+        }
+
+        void Manager::remove_handle (Chunk *chunk)
+        {
+            remove_handle (chunk->handle ());
+        }
+
+        CURL *Manager::acquire_handle ()
+        {
+            if (_priv->idle_handles.empty ())
+                return curl_easy_init ();
+
+            CURL *handle = _priv->idle_handles.back ();
+            _priv->idle_handles.pop_back ();
+            return handle;
+        }
+
+        void Manager::release_handle (CURL *handle)
+        {
+            if (!handle)
+                return;
+
+            if (_priv->idle_handles.size () >= max_idle_handles) {
+                curl_easy_cleanup (handle);
+                return;
+            }
+
+            // options go back to their defaults; live connections, the
+            // DNS cache and TLS sessions stay
+            curl_easy_reset (handle);
+            _priv->idle_handles.push_back (handle);
+        }
+
+        std::string Manager::pick_address (const std::string &url)
+        {
+            std::string host, port;
+            if (!split_origin (url, host, port))
+                return std::string ();
+
+            std::string key = host + ":" + port;
+            hostmap_t::iterator found = _priv->hosts.find (key);
+            if (found == _priv->hosts.end ()) {
+                // the first connection goes wherever curl sends it while
+                // we find out what else there is
+                _priv->hosts[key];
+                Gio::Resolver::get_default ()->lookup_by_name_async
+                    (host, sigc::bind (sigc::mem_fun
+                                       (*_priv, &Private::on_resolved),
+                                       key, host));
+                return std::string ();
+            }
+
+            std::vector<Address> &addresses = found->second;
+            if (addresses.size () < 2)
+                return std::string ();
+
+            bool measured = false;
+            for (std::vector<Address>::iterator i = addresses.begin ();
+                 i != addresses.end (); ++i)
+                measured |= i->measured;
+
+            // every address gets tried, then each connection goes where
+            // it would get the best share of the speed seen. until there
+            // is something to go by, they're dealt out evenly
+            std::vector<Address>::iterator best = addresses.end ();
+            double best_score = -1;
+            for (std::vector<Address>::iterator i = addresses.begin ();
+                 i != addresses.end (); ++i) {
+                if (!i->measured && i->connections == 0) {
+                    best = i;
+                    break;
+                }
+
+                double score = (measured ? i->throughput : 1.0) /
+                    (i->connections + 1);
+                if (score > best_score) {
+                    best = i;
+                    best_score = score;
+                }
+            }
+
+            best->connections++;
 
+            // literal IPv6 addresses are bracketed
+            std::string ip = best->ip.find (':') == std::string::npos ?
+                best->ip : "[" + best->ip + "]";
+            return key + ":" + ip + ":" + port;
+        }
+
+        void Manager::address_done (const std::string &url,
+                                    const std::string &address,
+                                    size_t bytes, double seconds,
+                                    bool failed)
+        {
+            std::string host, port;
+            if (address.empty () || !split_origin (url, host, port))
+                return;
+
+            hostmap_t::iterator found = _priv->hosts.find (host + ":" + port);
+            if (found == _priv->hosts.end ())
+                return;
+
+            // host:port:ip:port, bracketed or not
+            std::string ip = address.substr (found->first.size () + 1);
+            ip.erase (ip.rfind (':'));
+            if (!ip.empty () && ip[0] == '[')
+                ip = ip.substr (1, ip.size () - 2);
+
+            std::vector<Address> &addresses = found->second;
+            for (std::vector<Address>::iterator i = addresses.begin ();
+                 i != addresses.end (); ++i) {
+                if (i->ip != ip)
+                    continue;
+
+                if (i->connections)
+                    i->connections--;
+
+                // one that couldn't even get going counts, however quick
+                if (seconds >= min_measured_time || (failed && !bytes)) {
+                    double rate = seconds > 0 ? bytes / seconds : 0;
+                    i->throughput = !i->measured ? rate :
+                        (1 - throughput_weight) * i->throughput +
+                        throughput_weight * rate;
+                    i->measured = true;
+                }
+                break;
+            }
+        }
+
+        void Manager::Private::on_resolved
+        (Glib::RefPtr<Gio::AsyncResult> &result,
+         std::string key, std::string host)
+        {
+            std::vector<Address> &addresses = hosts[key];
+
+            try {
+                auto resolved =
+                    Gio::Resolver::get_default ()->lookup_by_name_finish
+                    (result);
+
+                for (auto i = resolved.begin (); i != resolved.end (); ++i) {
+                    Address address = { (*i)->to_string (), 0, false, 0 };
+                    addresses.push_back (address);
+                }
+            } catch (Glib::Error &e) {
+                // curl will have its own go at it, and tell the chunk
+                g_warning ("Could not resolve %s: %s", host.c_str (),
+                           e.what ().c_str ());
+            }
+        }
+
+        void Manager::add_handle (CURL *handle, const std::string &url,
+                                  const DoneSlot &done)
+        {
             curl_easy_setopt (handle,
                               CURLOPT_SHARE,
                               _priv->sharehandle);
             curl_multi_add_handle (_priv->multihandle, handle);
 
-            _priv->chunkmap.insert (std::make_pair (handle, chunk));
+            Transfer &transfer = _priv->chunkmap[handle];
+            transfer.url = url;
+            transfer.done = done;
             _priv->running_handles++;
+
+            Metrics::get ().handle_added (url);
         }
 
-        void Manager::remove_handle (Chunk *chunk)
+        void Manager::remove_handle (CURL *handle)
         {
-            CURL *handle = chunk->handle ();
             chunkmap_t::iterator result =
                 _priv->chunkmap.find (handle);
 
@@ -117,6 +363,8 @@ namespace Yatta
                 return;
 
             curl_multi_remove_handle (_priv->multihandle, handle);
+            Metrics::get ().handle_removed (result->second.url);
+
             _priv->chunkmap.erase (result);
             _priv->running_handles = _priv->chunkmap.size ();
         }
@@ -129,6 +377,7 @@ namespace Yatta
         {
             (void) easy;        // avoid warning about unused params
             (void) socketp;
+            YATTA_TRACE_SCOPE ("Manager::on_curl_socket");
             Manager *self = static_cast<Manager *> (userp);
 
             pollmap_t::iterator result = self->_priv->pollmap.find (s);
@@ -205,6 +454,7 @@ namespace Yatta
         bool Manager::dispatch (sigc::slot_base *slot)
         {
             (void) slot;        // dummy value from connect_generic
+            YATTA_TRACE_SCOPE ("Manager::dispatch");
 
             // copy the current running handles over
             int running_handles = _priv->running_handles;
@@ -250,12 +500,14 @@ namespace Yatta
                 chunkmap_t::iterator iter =
                     _priv->chunkmap.find (handle);
                 if (iter == _priv->chunkmap.end ()) {
-                    g_critical ("Missing Chunk");
+                    g_critical ("Missing transfer");
                     continue;
                 }
 
-                // handle removal of chunk
-                iter->second->stop_finished (result);
+                // the slot removes the handle, taking the map entry with
+                // it, so call a copy
+                DoneSlot done = iter->second.done;
+                done (result);
             }
 
             _priv->running_handles = running_handles;
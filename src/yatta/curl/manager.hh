@@ -18,8 +18,9 @@
 #ifndef YATTA_CURL_MANAGER_H
 #define YATTA_CURL_MANAGER_H
 
-#include <tr1/memory>
+#include <memory>
 #include <map>
+#include <string>
 
 #include <glibmm/main.h>
 #include <glibmm/refptr.h>
@@ -35,9 +36,44 @@ namespace Yatta
         class Manager : public Glib::Source
         {
             public:
+                typedef sigc::slot<void, CURLcode> DoneSlot;
+
+                // let Yatta::Chunk::create hand out curl chunks. curl
+                // itself isn't set up until the first one starts
+                static void install ();
+
+                // made and attached to the main loop on first use
                 static Glib::RefPtr<Manager> get ();
                 void add_handle (Chunk *chunk);
                 void remove_handle (Chunk *chunk);
+
+                // run any easy handle, calling done when it finishes.
+                // url is only used for the metrics
+                void add_handle (CURL *handle, const std::string &url,
+                                 const DoneSlot &done);
+                void remove_handle (CURL *handle);
+
+                // easy handles are reset and kept for the next chunk,
+                // rather than being cleaned up and made afresh
+                static const size_t max_idle_handles = 32;
+                CURL *acquire_handle ();
+                void release_handle (CURL *handle);
+
+                // hosts with several addresses get their connections
+                // spread over all of them, leaning towards whichever have
+                // given the best speed so far. returns the address for
+                // the next connection to url, or an empty string to let
+                // curl choose (not resolved yet, or just the one address)
+                std::string pick_address (const std::string &url);
+
+                // a connection to address, from pick_address, is done
+                // with after moving bytes in seconds. failed if it broke
+                // down rather than being stopped or finishing
+                void address_done (const std::string &url,
+                                   const std::string &address,
+                                   size_t bytes, double seconds,
+                                   bool failed);
+
                 virtual ~Manager ();
 
             protected:
@@ -57,7 +93,7 @@ namespace Yatta
 
             private:
                 struct Private;
-                std::tr1::shared_ptr<Private> _priv;
+                std::unique_ptr<Private> _priv;
         };
     }
 }
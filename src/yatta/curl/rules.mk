@@ -1,6 +1,8 @@
 libyatta_la_SOURCES += \
 	src/yatta/curl/manager.cc \
 	src/yatta/curl/chunk.cc \
+	src/yatta/curl/fetch.cc \
+	src/yatta/curl/fetch.hh \
 	src/yatta/curl/manager.hh \
 	src/yatta/curl/chunk.hh
 
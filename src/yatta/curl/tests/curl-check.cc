@@ -1,7 +1,7 @@
 #include <glibmm.h>
 #include <giomm.h>
 #include "../manager.hh"
-#include "../download.hh"
+#include "../../download.hh"
 
 struct bla
 {
@@ -18,12 +18,11 @@ int main ()
 {
     Glib::init ();
     Gio::init ();
-    Glib::RefPtr<Yatta::Curl::Manager> mgr = Yatta::Curl::Manager::get ();
-    mgr->attach ();
+    Yatta::Curl::Manager::install ();
 
-    Yatta::Curl::Download dl ("http://sg.releases.ubuntu.com/9.10/ubuntu-9.10-desktop-amd64.iso", "/tmp", "ubuntu.iso");
-    // Yatta::Curl::Download dl ("http://localhost/test.file", "/tmp", "test.file");
-    // Yatta::Curl::Download dl ("http://www.ubuntu.com", "/tmp", "testing");
+    Yatta::Download dl ("http://sg.releases.ubuntu.com/9.10/ubuntu-9.10-desktop-amd64.iso", "/tmp", "ubuntu.iso");
+    // Yatta::Download dl ("http://localhost/test.file", "/tmp", "test.file");
+    // Yatta::Download dl ("http://www.ubuntu.com", "/tmp", "testing");
     dl.start ();
     bla func (Glib::MainLoop::create ());
     dl.connect_signal_finished (sigc::slot<void> (func));
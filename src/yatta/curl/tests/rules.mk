@@ -8,5 +8,6 @@ curl_check_LDADD = \
 	libyatta.la
 
 curl_check_CXXFLAGS = \
+	$(AM_CXXFLAGS) \
 	$(CURL_CFLAGS) \
 	$(GTKMM_CFLAGS)
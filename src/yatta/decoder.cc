@@ -0,0 +1,297 @@
+/* decoder.cc -- undoing a Content-Encoding as the data goes by
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cerrno>
+#include <strings.h>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "decoder.hh"
+
+using Yatta::Decoder;
+
+namespace
+{
+    // gzip and zlib-wrapped deflate are told apart by their headers.
+    // some servers send raw deflate for "deflate", which only shows
+    // once the zlib header fails to parse
+    class ZlibDecoder : public Decoder
+    {
+    public:
+        explicit ZlibDecoder (bool deflate) :
+            _deflate (deflate),
+            _started (false),
+            _ended (false)
+        {
+            init (15 + 32);
+        }
+
+        virtual ~ZlibDecoder ()
+        {
+            inflateEnd (&_stream);
+        }
+
+    protected:
+        virtual long step (const char *&data, size_t &size,
+                           char *buffer, size_t space)
+        {
+            // gzip files may be several members one after the other
+            if (_ended) {
+                if (size == 0)
+                    return 0;
+                inflateReset (&_stream);
+                _ended = false;
+            }
+
+            _stream.next_in =
+                reinterpret_cast<Bytef *> (const_cast<char *> (data));
+            _stream.avail_in = size;
+            _stream.next_out = reinterpret_cast<Bytef *> (buffer);
+            _stream.avail_out = space;
+
+            int result = inflate (&_stream, Z_NO_FLUSH);
+            if (result == Z_DATA_ERROR && _deflate && !_started) {
+                inflateEnd (&_stream);
+                init (-15);
+                _stream.next_in =
+                    reinterpret_cast<Bytef *> (const_cast<char *> (data));
+                _stream.avail_in = size;
+                result = inflate (&_stream, Z_NO_FLUSH);
+            }
+
+            size_t used = size - _stream.avail_in;
+            data += used;
+            size -= used;
+            _started = true;
+
+            if (result == Z_STREAM_END)
+                _ended = true;
+            else if (result != Z_OK && result != Z_BUF_ERROR)
+                return -1;
+
+            return space - _stream.avail_out;
+        }
+
+        virtual bool complete () const
+        {
+            return _ended;
+        }
+
+    private:
+        void init (int window_bits)
+        {
+            _stream.zalloc = Z_NULL;
+            _stream.zfree = Z_NULL;
+            _stream.opaque = Z_NULL;
+            _stream.next_in = Z_NULL;
+            _stream.avail_in = 0;
+            inflateInit2 (&_stream, window_bits);
+        }
+
+        z_stream _stream;
+        bool     _deflate;
+        bool     _started;
+        bool     _ended;
+    };
+
+#ifdef HAVE_ZSTD
+    class ZstdDecoder : public Decoder
+    {
+    public:
+        ZstdDecoder () : _stream (ZSTD_createDStream ()), _remaining (1)
+        {
+            ZSTD_initDStream (_stream);
+        }
+
+        virtual ~ZstdDecoder ()
+        {
+            ZSTD_freeDStream (_stream);
+        }
+
+    protected:
+        virtual long step (const char *&data, size_t &size,
+                           char *buffer, size_t space)
+        {
+            ZSTD_inBuffer in = { data, size, 0 };
+            ZSTD_outBuffer out = { buffer, space, 0 };
+
+            size_t result = ZSTD_decompressStream (_stream, &out, &in);
+            if (ZSTD_isError (result))
+                return -1;
+            _remaining = result;
+
+            data += in.pos;
+            size -= in.pos;
+            return out.pos;
+        }
+
+        // 0 once a frame is done and flushed, a hint of what's still to
+        // come otherwise
+        virtual bool complete () const
+        {
+            return _remaining == 0;
+        }
+
+    private:
+        ZSTD_DStream *_stream;
+        size_t        _remaining;
+    };
+#endif
+
+#ifdef HAVE_LZMA
+    class XzDecoder : public Decoder
+    {
+    public:
+        XzDecoder () : _stream (), _ready (false), _ended (false)
+        {
+            lzma_stream init = LZMA_STREAM_INIT;
+            _stream = init;
+            _ready = lzma_stream_decoder (&_stream, UINT64_MAX,
+                                          LZMA_CONCATENATED) == LZMA_OK;
+        }
+
+        virtual ~XzDecoder ()
+        {
+            lzma_end (&_stream);
+        }
+
+    protected:
+        virtual long step (const char *&data, size_t &size,
+                           char *buffer, size_t space)
+        {
+            if (!_ready)
+                return -1;
+            if (_ended)
+                return 0;
+
+            _stream.next_in = reinterpret_cast<const uint8_t *> (data);
+            _stream.avail_in = size;
+            _stream.next_out = reinterpret_cast<uint8_t *> (buffer);
+            _stream.avail_out = space;
+
+            // streams may follow one another, so the end only shows
+            // once we say there's no more
+            lzma_ret result =
+                lzma_code (&_stream, finishing () ? LZMA_FINISH : LZMA_RUN);
+            if (result == LZMA_STREAM_END)
+                _ended = true;
+
+            size_t used = size - _stream.avail_in;
+            data += used;
+            size -= used;
+
+            if (result != LZMA_OK && result != LZMA_STREAM_END &&
+                result != LZMA_BUF_ERROR)
+                return -1;
+
+            return space - _stream.avail_out;
+        }
+
+        virtual bool complete () const
+        {
+            return _ended;
+        }
+
+    private:
+        lzma_stream _stream;
+        bool        _ready;
+        bool        _ended;
+    };
+#endif
+}
+
+const size_t Decoder::buffer_size;
+
+std::unique_ptr<Decoder> Decoder::create (const std::string &encoding)
+{
+    const char *name = encoding.c_str ();
+
+    if (strcasecmp (name, "gzip") == 0 || strcasecmp (name, "x-gzip") == 0)
+        return std::unique_ptr<Decoder> (new ZlibDecoder (false));
+    if (strcasecmp (name, "deflate") == 0)
+        return std::unique_ptr<Decoder> (new ZlibDecoder (true));
+#ifdef HAVE_ZSTD
+    if (strcasecmp (name, "zstd") == 0)
+        return std::unique_ptr<Decoder> (new ZstdDecoder);
+#endif
+#ifdef HAVE_LZMA
+    if (strcasecmp (name, "xz") == 0)
+        return std::unique_ptr<Decoder> (new XzDecoder);
+#endif
+
+    return std::unique_ptr<Decoder> ();
+}
+
+std::string Decoder::accepted ()
+{
+    std::string encodings;
+#ifdef HAVE_ZSTD
+    encodings += "zstd, ";
+#endif
+#ifdef HAVE_LZMA
+    encodings += "xz, ";
+#endif
+    return encodings + "gzip, deflate";
+}
+
+int Decoder::decode (const char *data, size_t size, const Output &output)
+{
+    if (_buffer.empty ())
+        _buffer.resize (buffer_size);
+
+    // until it neither takes in nor gives out anything more
+    for (;;) {
+        size_t before = size;
+        long produced = step (data, size, &_buffer[0], _buffer.size ());
+        if (produced < 0)
+            return EBADMSG;
+
+        if (produced == 0 && size == before)
+            return 0;
+
+        if (produced > 0) {
+            int error = output (&_buffer[0], produced, _position);
+            _position += produced;
+            if (error)
+                return error;
+        }
+    }
+}
+
+int Decoder::finish (const Output &output)
+{
+    _finishing = true;
+
+    int error = decode (NULL, 0, output);
+    if (error)
+        return error;
+
+    return complete () ? 0 : EBADMSG;
+}
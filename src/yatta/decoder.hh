@@ -0,0 +1,95 @@
+/* decoder.hh -- undoing a Content-Encoding as the data goes by
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_DECODER_H
+#define YATTA_DECODER_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Yatta
+{
+    /**
+     * @brief: Decompresses a whole encoded body, a buffer at a time
+     *
+     * gzip and deflate are always there, zstd and xz if we were built
+     * with them. The compressed data has to come in order, from the
+     * start, which only holds for a download fetched whole. Decoded
+     * data is handed out in pieces of at most buffer_size as it comes.
+     *
+     * Plain C++, no glib: the DiskWriter thread is the one that runs it.
+     */
+    class Decoder
+    {
+    public:
+        // gets each decoded piece, and where in the decoded file it
+        // goes. returns 0, or an errno to stop decoding with
+        typedef std::function<int (const char * /* data */,
+                                   size_t /* size */,
+                                   size_t /* offset */)> Output;
+
+        static const size_t buffer_size = 256 * 1024;
+
+        // NULL if encoding isn't one we know
+        static std::unique_ptr<Decoder> create (const std::string &encoding);
+
+        // what we can take, for Accept-Encoding
+        static std::string accepted ();
+
+        virtual ~Decoder () {}
+
+        // returns 0, whatever output returned if it wasn't, or EBADMSG
+        // for data that doesn't decode
+        int decode (const char *data, size_t size, const Output &output);
+
+        // the data is all in: hand out whatever is still held back.
+        // EBADMSG if the stream ended before it should have
+        int finish (const Output &output);
+
+        // decoded bytes handed out so far
+        size_t position () const { return _position; }
+
+    protected:
+        Decoder () : _position (0), _finishing (false), _buffer () {}
+
+        // decode what fits into buffer, moving data and size past what
+        // was used. returns the number of bytes put in buffer, or -1
+        // if the data is bad. called again while it's still making
+        // progress
+        virtual long step (const char *&data, size_t &size,
+                           char *buffer, size_t space) = 0;
+
+        // whether what came in so far is a whole stream
+        virtual bool complete () const = 0;
+
+        // inside finish (): step () won't get any more data after this
+        bool finishing () const { return _finishing; }
+
+    private:
+        Decoder (const Decoder &) = delete;
+
+        size_t            _position;
+        bool              _finishing;
+        std::vector<char> _buffer;
+    };
+}
+
+#endif // YATTA_DECODER_H
@@ -0,0 +1,262 @@
+/* directwriter.cc -- assembles chunk data into aligned O_DIRECT writes
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "directwriter.hh"
+
+using Yatta::DirectWriter;
+
+namespace
+{
+    int pwrite_all (int fd, const char *data, size_t size, size_t offset)
+    {
+        while (size > 0) {
+            ssize_t written = pwrite (fd, data, size, offset);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return errno;
+            }
+
+            data += written;
+            size -= written;
+            offset += written;
+        }
+
+        return 0;
+    }
+
+    size_t align_down (size_t value)
+    {
+        return value - value % DirectWriter::alignment ();
+    }
+
+    size_t align_up (size_t value)
+    {
+        return align_down (value + DirectWriter::alignment () - 1);
+    }
+}
+
+struct DirectWriter::Private
+{
+    // the data of one stream since its last whole block went out
+    struct Stage
+    {
+        char         *buffer; // aligned, stage_size bytes
+        size_t        base;   // file offset of buffer[0], aligned
+        size_t        valid;  // where the data starts in a head block
+        size_t        length; // bytes in buffer, counting up to valid
+        unsigned long used;
+
+        size_t end () const { return base + length; }
+    };
+
+    // keyed by where the next write of the stream is expected
+    typedef std::map<size_t, Stage> stage_map_t;
+
+    Private (int direct_fd, int buffered_fd, size_t stage_size) :
+        direct_fd (direct_fd),
+        buffered_fd (buffered_fd),
+        stage_size (std::max (align_up (stage_size), alignment ())),
+        stages (),
+        clock (0)
+    {}
+
+    ~Private ()
+    {
+        for (stage_map_t::iterator i = stages.begin ();
+             i != stages.end (); ++i)
+            std::free (i->second.buffer);
+    }
+
+    // write the whole blocks of s, and with final, what's left as well.
+    // otherwise the partial block left over moves to the front
+    int write_out (Stage &s, bool final)
+    {
+        size_t block = alignment ();
+        size_t blocks_end = align_down (s.length);
+        size_t pos = 0;
+        int error = 0;
+
+        // a head block that doesn't start on the boundary
+        if (s.valid > 0 && blocks_end > 0) {
+            error = pwrite_all (buffered_fd, s.buffer + s.valid,
+                                block - s.valid, s.base + s.valid);
+            if (error)
+                return error;
+
+            pos = block;
+        }
+
+        if (pos < blocks_end) {
+            error = pwrite_all (direct_fd, s.buffer + pos,
+                                blocks_end - pos, s.base + pos);
+            if (error)
+                return error;
+        }
+
+        if (final) {
+            size_t tail = blocks_end > 0 ? blocks_end : s.valid;
+            if (s.length > tail)
+                error = pwrite_all (buffered_fd, s.buffer + tail,
+                                    s.length - tail, s.base + tail);
+
+            s.length = s.valid = 0;
+            return error;
+        }
+
+        if (blocks_end > 0) {
+            std::memmove (s.buffer, s.buffer + blocks_end,
+                          s.length - blocks_end);
+            s.base += blocks_end;
+            s.length -= blocks_end;
+            s.valid = 0;
+        }
+
+        return 0;
+    }
+
+    int new_stage (size_t offset, Stage &s)
+    {
+        void *buffer;
+        int error = posix_memalign (&buffer, alignment (), stage_size);
+        if (error)
+            return error;
+
+        s.buffer = static_cast<char *> (buffer);
+        s.base = align_down (offset);
+        s.valid = s.length = offset - s.base;
+        s.used = 0;
+
+        return 0;
+    }
+
+    // make room for one more stream by finishing the quietest one
+    int evict ()
+    {
+        stage_map_t::iterator oldest = stages.begin ();
+        for (stage_map_t::iterator i = stages.begin ();
+             i != stages.end (); ++i)
+            if (i->second.used < oldest->second.used)
+                oldest = i;
+
+        Stage s = oldest->second;
+        stages.erase (oldest);
+
+        int error = write_out (s, true);
+        std::free (s.buffer);
+        return error;
+    }
+
+    int           direct_fd;
+    int           buffered_fd;
+    size_t        stage_size;
+    stage_map_t   stages;
+    unsigned long clock;
+};
+
+const size_t DirectWriter::default_stage_size;
+const size_t DirectWriter::max_stages;
+
+DirectWriter::DirectWriter (int direct_fd, int buffered_fd,
+                            size_t stage_size) :
+    _priv (new Private (direct_fd, buffered_fd, stage_size))
+{
+}
+
+DirectWriter::~DirectWriter ()
+{
+}
+
+int DirectWriter::write (size_t offset, const char *data, size_t size)
+{
+    while (size > 0) {
+        Private::Stage s;
+        Private::stage_map_t::iterator i = _priv->stages.find (offset);
+
+        if (i != _priv->stages.end ()) {
+            s = i->second;
+            _priv->stages.erase (i);
+        } else {
+            if (_priv->stages.size () >= max_stages) {
+                int error = _priv->evict ();
+                if (error)
+                    return error;
+            }
+
+            int error = _priv->new_stage (offset, s);
+            if (error)
+                return error;
+        }
+
+        size_t n = std::min (size, _priv->stage_size - s.length);
+        std::memcpy (s.buffer + s.length, data, n);
+        s.length += n;
+        data += n;
+        size -= n;
+        offset += n;
+
+        int error = 0;
+        if (s.length == _priv->stage_size)
+            error = _priv->write_out (s, false);
+
+        // back in the map either way, so the buffer isn't lost. two
+        // streams only meet like this if they overlap; finish this one
+        s.used = ++_priv->clock;
+        if (!_priv->stages.insert (std::make_pair (s.end (), s)).second) {
+            int final_error = _priv->write_out (s, true);
+            std::free (s.buffer);
+            error = error ? error : final_error;
+        }
+
+        if (error)
+            return error;
+    }
+
+    return 0;
+}
+
+int DirectWriter::flush ()
+{
+    int result = 0;
+
+    for (Private::stage_map_t::iterator i = _priv->stages.begin ();
+         i != _priv->stages.end (); ++i) {
+        int error = _priv->write_out (i->second, true);
+        if (error && !result)
+            result = error;
+
+        std::free (i->second.buffer);
+    }
+    _priv->stages.clear ();
+
+    return result;
+}
+
+size_t DirectWriter::alignment ()
+{
+    static size_t page = sysconf (_SC_PAGESIZE);
+    return page;
+}
@@ -0,0 +1,68 @@
+/* directwriter.hh -- assembles chunk data into aligned O_DIRECT writes
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_DIRECTWRITER_H
+#define YATTA_DIRECTWRITER_H
+
+#include <memory>
+#include <cstddef>
+
+namespace Yatta
+{
+    /**
+     * @brief: Writes a file around the page cache
+     *
+     * Every chunk writes sequentially from its own offset, so data is
+     * staged per stream, in aligned buffers, and only whole aligned
+     * blocks go out through the O_DIRECT descriptor. The partial block
+     * at the start of a stream and the one at its end (a chunk
+     * boundary, or EOF) go through the buffered descriptor instead;
+     * those are the only writes that touch the page cache.
+     *
+     * Plain POSIX and synchronous: IOQueue runs it on the DiskWriter
+     * thread, one call at a time. Errors are returned as errno values.
+     */
+    class DirectWriter
+    {
+    public:
+        // per stream staging buffer, and how many streams to stage
+        static const size_t default_stage_size = 1024 * 1024;
+        static const size_t max_stages = 64;
+
+        // neither descriptor is closed by us
+        DirectWriter (int direct_fd, int buffered_fd,
+                      size_t stage_size = default_stage_size);
+        ~DirectWriter ();
+
+        int write (size_t offset, const char *data, size_t size);
+
+        // write out everything staged, partial blocks included
+        int flush ();
+
+        // what offsets, sizes and buffers have to be multiples of
+        static size_t alignment ();
+
+    private:
+        DirectWriter (const DirectWriter &) = delete;
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_DIRECTWRITER_H
@@ -0,0 +1,421 @@
+/* diskwriter.cc -- a thread of its own for file writes
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#include <glibmm/dispatcher.h>
+
+#include "diskwriter.hh"
+#include "decoder.hh"
+#include "directwriter.hh"
+#include "writeback.hh"
+#include "spscring.hh"
+
+using Yatta::DiskWriter;
+
+namespace
+{
+    // writer thread
+
+    int write_file (int fd, const char *data, size_t size, size_t offset)
+    {
+        while (size > 0) {
+            ssize_t written = pwrite (fd, data, size, offset);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                return errno;
+            }
+
+            data += written;
+            size -= written;
+            offset += written;
+        }
+
+        return 0;
+    }
+
+    // pipes may be non-blocking; we're on our own thread, so wait
+    int append_file (int fd, const char *data, size_t size)
+    {
+        while (size > 0) {
+            ssize_t written = ::write (fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct pollfd pfd = { fd, POLLOUT, 0 };
+                    poll (&pfd, 1, -1);
+                    continue;
+                }
+
+                return errno;
+            }
+
+            data += written;
+            size -= written;
+        }
+
+        return 0;
+    }
+
+    // in the kernel if possible: server side on NFS, or at least
+    // without going through our buffers. the last resort is a read and
+    // write loop
+    int copy_file (int fd, int source, size_t size, size_t offset)
+    {
+#ifdef HAVE_COPY_FILE_RANGE
+        while (size > 0) {
+            loff_t in = offset, out = offset;
+            ssize_t copied = copy_file_range (source, &in, fd, &out,
+                                              size, 0);
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied <= 0)
+                break;
+
+            size -= copied;
+            offset += copied;
+        }
+#endif
+
+#ifdef HAVE_SENDFILE
+        // writes at the file position, which only we use
+        if (size > 0 && lseek (fd, offset, SEEK_SET) >= 0) {
+            while (size > 0) {
+                off_t in = offset;
+                ssize_t copied = sendfile (fd, source, &in, size);
+                if (copied < 0 && errno == EINTR)
+                    continue;
+                if (copied <= 0)
+                    break;
+
+                size -= copied;
+                offset += copied;
+            }
+        }
+#endif
+
+        std::vector<char> buffer (size > 0 ? 1024 * 1024 : 0);
+        while (size > 0) {
+            ssize_t got = pread (source, &buffer[0],
+                                 std::min (size, buffer.size ()), offset);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                return errno;
+            if (got == 0)
+                return EIO;     // the source got shorter
+
+            int error = write_file (fd, &buffer[0], got, offset);
+            if (error)
+                return error;
+
+            size -= got;
+            offset += got;
+        }
+
+        return 0;
+    }
+
+    // the kernel's copy would go through the page cache, under the
+    // DirectWriter's feet. so with O_DIRECT the data comes through it
+    // like any other
+    int copy_direct (Yatta::DirectWriter &direct, int source, size_t size,
+                     size_t offset)
+    {
+        std::vector<char> buffer (std::min (size, size_t (1024 * 1024)));
+        while (size > 0) {
+            ssize_t got = pread (source, &buffer[0],
+                                 std::min (size, buffer.size ()), offset);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                return errno;
+            if (got == 0)
+                return EIO;     // the source got shorter
+
+            int error = direct.write (offset, &buffer[0], got);
+            if (error)
+                return error;
+
+            size -= got;
+            offset += got;
+        }
+
+        return 0;
+    }
+
+    // a WRITE or APPEND of data, in place of the request's own
+    int write_out (const DiskWriter::Request &request, const char *data,
+                   size_t size, size_t offset)
+    {
+        if (request.kind == DiskWriter::Request::APPEND || request.append)
+            return append_file (request.fd, data, size);
+
+        if (request.direct)
+            return request.direct->write (offset, data, size);
+
+        int error = write_file (request.fd, data, size, offset);
+        if (!error && request.writeback)
+            error = request.writeback->written (offset, size);
+        return error;
+    }
+
+    int execute (const DiskWriter::Request &request)
+    {
+        if (request.kind == DiskWriter::Request::FINISH) {
+            int error = 0;
+            if (request.decoder)
+                error = request.decoder->finish
+                    ([&request] (const char *data, size_t size,
+                                 size_t offset) {
+                        return write_out (request, data, size, offset);
+                    });
+
+            if (!error && request.direct)
+                error = request.direct->flush ();
+            else if (!error && request.writeback)
+                error = request.writeback->flush ();
+            return error;
+        }
+
+        if (request.decoder &&
+            (request.kind == DiskWriter::Request::WRITE ||
+             request.kind == DiskWriter::Request::APPEND))
+            return request.decoder->decode
+                (request.data, request.size,
+                 [&request] (const char *data, size_t size, size_t offset) {
+                    return write_out (request, data, size, offset);
+                });
+
+        if (request.kind == DiskWriter::Request::APPEND)
+            return append_file (request.fd, request.data, request.size);
+
+        if (request.kind == DiskWriter::Request::FLUSH) {
+            if (request.direct)
+                return request.direct->flush ();
+            if (request.writeback)
+                return request.writeback->flush ();
+            return 0;
+        }
+
+        if (request.kind == DiskWriter::Request::COPY) {
+            if (request.direct)
+                return copy_direct (*request.direct, request.source,
+                                    request.size, request.offset);
+
+            int error = copy_file (request.fd, request.source,
+                                   request.size, request.offset);
+            if (!error && request.writeback)
+                error = request.writeback->written (request.offset,
+                                                    request.size);
+            return error;
+        }
+
+        return write_out (request, request.data, request.size,
+                          request.offset);
+    }
+}
+
+struct DiskWriter::Private
+{
+    typedef SPSCRing<Request *, ring_size> ring_t;
+
+    Private () :
+        requests (),
+        completions (),
+        sleeping (0),
+        notified (0),
+        quitting (false),
+        dispatcher (),
+        thread (),
+        in_flight (0),
+        backlog ()
+    {
+        wakeup[0] = wakeup[1] = -1;
+    }
+
+    // main loop: get the writer going if it's waiting for work
+    void wake ()
+    {
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        int expected = 1;
+        if (sleeping.compare_exchange_strong (expected, 0)) {
+            // a byte already sitting in the pipe will do as well
+            char byte = 0;
+            while (::write (wakeup[1], &byte, 1) < 0 && errno == EINTR);
+        }
+    }
+
+    // writer thread: wait until wake () is called
+    void sleep ()
+    {
+        sleeping = 1;
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+
+        // something came in while we were getting ready
+        if (!requests.empty () || quitting) {
+            sleeping = 0;
+            return;
+        }
+
+        char byte;
+        while (read (wakeup[0], &byte, 1) < 0 && errno == EINTR);
+        sleeping = 0;
+    }
+
+    // at most ring_size requests are out at once, so neither ring can
+    // ever be full when pushed to
+    ring_t            requests;     // main loop -> writer
+    ring_t            completions;  // writer -> main loop
+
+    std::atomic<int>  sleeping;
+    std::atomic<int>  notified;     // dispatcher emitted, not yet run
+    std::atomic<bool> quitting;
+    int               wakeup[2];
+
+    Glib::Dispatcher  dispatcher;
+    std::thread       thread;
+
+    // main loop only
+    size_t              in_flight;
+    std::deque<Request *> backlog;
+};
+
+const size_t DiskWriter::ring_size;
+
+DiskWriter::DiskWriter ()
+{
+    _priv.reset (new Private);
+    _priv->dispatcher.connect (sigc::mem_fun (*this,
+                                              &DiskWriter::on_dispatch));
+
+    if (pipe (_priv->wakeup) != 0)
+        g_error ("Could not create disk writer pipe: %s",
+                 g_strerror (errno));
+
+    // the main loop must never block on it
+    fcntl (_priv->wakeup[1], F_SETFL,
+           fcntl (_priv->wakeup[1], F_GETFL) | O_NONBLOCK);
+
+    _priv->thread = std::thread (&DiskWriter::run, this);
+}
+
+DiskWriter::~DiskWriter ()
+{
+    // the rings get written out first; nobody is left to hear about it
+    _priv->quitting = true;
+
+    char byte = 0;
+    while (::write (_priv->wakeup[1], &byte, 1) < 0 && errno == EINTR);
+    _priv->thread.join ();
+
+    close (_priv->wakeup[0]);
+    close (_priv->wakeup[1]);
+}
+
+DiskWriter &DiskWriter::get ()
+{
+    static DiskWriter instance;
+    return instance;
+}
+
+void DiskWriter::submit (Request *request)
+{
+    // keep the order: nothing overtakes the backlog
+    if (!_priv->backlog.empty () || _priv->in_flight == ring_size) {
+        _priv->backlog.push_back (request);
+        return;
+    }
+
+    _priv->requests.push (request);
+    ++_priv->in_flight;
+    _priv->wake ();
+}
+
+// writer thread
+void DiskWriter::run ()
+{
+    for (;;) {
+        Request *request;
+
+        while (_priv->requests.pop (request)) {
+            request->started = g_get_monotonic_time ();
+            request->error = execute (*request);
+            request->finished = g_get_monotonic_time ();
+
+            _priv->completions.push (request);
+
+            // one emission covers everything until on_dispatch runs
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            int expected = 0;
+            if (_priv->notified.compare_exchange_strong (expected, 1))
+                _priv->dispatcher ();
+        }
+
+        if (_priv->quitting)
+            break;
+
+        _priv->sleep ();
+    }
+}
+
+// main loop
+void DiskWriter::on_dispatch ()
+{
+    // anything completed after this gets a dispatch of its own
+    _priv->notified = 0;
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+
+    Request *request;
+    while (_priv->completions.pop (request)) {
+        --_priv->in_flight;
+
+        // room again: move the backlog along before the client can
+        // submit more behind it
+        for (; !_priv->backlog.empty () &&
+                 _priv->in_flight < ring_size; _priv->backlog.pop_front ()) {
+            _priv->requests.push (_priv->backlog.front ());
+            ++_priv->in_flight;
+            _priv->wake ();
+        }
+
+        request->owner->on_write_done (*request);
+    }
+}
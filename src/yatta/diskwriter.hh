@@ -0,0 +1,123 @@
+/* diskwriter.hh -- a thread of its own for file writes
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_DISKWRITER_H
+#define YATTA_DISKWRITER_H
+
+#include <memory>
+#include <cstddef>
+
+#include <glib.h>
+
+namespace Yatta
+{
+    class Decoder;
+    class DirectWriter;
+    class Writeback;
+
+    /**
+     * @brief: Runs every file write on one dedicated thread
+     *
+     * Requests go to the thread through a lock-free SPSCRing, and come
+     * back through another, so submitting never takes a lock or waits
+     * for the disk, and writes never queue up behind the open ()s and
+     * close ()s on the WorkerPool. Requests are carried out strictly in
+     * the order they were submitted. Once one is done, its owner's
+     * on_write_done () is called from the main loop.
+     *
+     * Only the main thread may submit. Whatever a request points at has
+     * to stay alive and untouched until it comes back.
+     */
+    class DiskWriter
+    {
+    public:
+        class Client;
+
+        struct Request
+        {
+            enum Kind
+            {
+                WRITE,
+                APPEND,
+                COPY,
+                FLUSH,
+                FINISH
+            };
+
+            Kind          kind;
+
+            // WRITE goes through direct or writeback if set, FLUSH
+            // flushes whichever of them is set. APPEND ignores offset
+            // and writes at fd's current position, for pipes. COPY
+            // takes size bytes at offset in source instead of data, to
+            // the same offset in fd, through direct if set. with a
+            // decoder, WRITE and APPEND data is decoded first, and goes
+            // wherever it comes out. FINISH ends the decoder's stream,
+            // writing what's left as WRITE would (APPEND if append is
+            // set), then does a FLUSH
+            int           fd;
+            int           source;
+            DirectWriter *direct;
+            Writeback    *writeback;
+            Decoder      *decoder;
+            bool          append;
+
+            const char   *data;
+            size_t        size;
+            size_t        offset;
+
+            // filled in by the writer thread
+            int           error;
+            gint64        started;
+            gint64        finished;
+
+            Client       *owner;
+        };
+
+        class Client
+        {
+        public:
+            virtual ~Client () {}
+
+            // main loop. the request belongs to the client again
+            virtual void on_write_done (Request &request) = 0;
+        };
+
+        // requests on their way, in both directions
+        static const size_t ring_size = 256;
+
+        static DiskWriter &get ();
+        ~DiskWriter ();
+
+        // never blocks. requests that don't fit in the ring wait in
+        // memory until it has room
+        void submit (Request *request);
+
+    private:
+        DiskWriter ();
+        DiskWriter (const DiskWriter &) = delete;
+
+        void run ();
+        void on_dispatch ();
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_DISKWRITER_H
@@ -16,19 +16,72 @@
  */
 
 #include <queue>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
 #include <limits>
+#include <algorithm>
 
 #include <sigc++/bind.h>
-#include <sigc++/hide.h>
 #include <sigc++/signal.h>
 #include <sigc++/connection.h>
+#include <glibmm/main.h>
 
 #include "download.hh"
 #include "ioqueue.hh"
 #include "chunk.hh"
+#include "metrics.hh"
+#include "decoder.hh"
+#include "hostinfo.hh"
+#include "filename.hh"
+#include "trace.hh"
 
 using Yatta::Download;
 
+const size_t Download::sequential_chunk_size;
+const unsigned Download::max_retries;
+const unsigned Download::stall_window;
+const unsigned Download::stall_ratio;
+
+namespace
+{
+    using Yatta::Chunk;
+
+    // milliseconds
+    const unsigned retry_base = 500;
+    const unsigned retry_cap = 60 * 1000;
+
+    // exponential, and only half of it fixed, so that chunks which failed
+    // together don't all come back at once. a host that said to slow down
+    // gets longer
+    unsigned retry_delay (unsigned attempts, Chunk::Failure failure)
+    {
+        unsigned base = failure == Chunk::THROTTLED ?
+            retry_base * 8 : retry_base;
+        unsigned delay = attempts > 16 ? retry_cap :
+            std::min (retry_cap, base << (attempts - 1));
+
+        return delay / 2 + g_random_int_range (0, delay / 2 + 1);
+    }
+
+    size_t min_speed_for_new_downloads = 0;
+    Download::Compression compression_for_new_downloads = Download::NONE;
+
+    const char *describe (Chunk::Failure failure)
+    {
+        switch (failure) {
+        case Chunk::TIMEOUT:    return "timed out";
+        case Chunk::CONNECTION: return "connection failed";
+        case Chunk::THROTTLED:  return "server busy";
+        case Chunk::SERVER:     return "server error";
+        case Chunk::REFUSED:    return "refused";
+        case Chunk::BAD_RANGE:  return "range not satisfiable";
+        default:                return "ended early";
+        }
+    }
+}
+
 struct Download::Private
 {
     Private (const Glib::ustring &url,
@@ -41,8 +94,56 @@ struct Download::Private
         size (0),
         running (false),
         fileio (dirname, filename),
-        check_resumable_connection (),
-        get_size_connection ()
+        answered (false),
+        probe (),
+        max_chunks_set (false),
+        started_at (0),
+        window_check (),
+        schedule (LARGEST_GAP),
+        read_head (0),
+        read_head_set (false),
+        pieces (),
+        sources (1, url.raw ()),
+        racers (),
+        retries (),
+        dead_sources (),
+        min_speed (min_speed_for_new_downloads),
+        stall_check (),
+        positions (),
+        compression (compression_for_new_downloads),
+        encoding (),
+        signal_error (),
+        metrics_id (Metrics::get ().add_download (url))
+    {}
+
+    Private (const Glib::ustring &url, int fd) :
+        url (url),
+        chunks (0),
+        max_chunks (30),
+        resumable (false),
+        size (0),
+        running (false),
+        fileio (fd),
+        answered (false),
+        probe (),
+        max_chunks_set (false),
+        started_at (0),
+        window_check (),
+        schedule (SEQUENTIAL),
+        read_head (0),
+        read_head_set (false),
+        pieces (),
+        sources (1, url.raw ()),
+        racers (),
+        retries (),
+        dead_sources (),
+        min_speed (min_speed_for_new_downloads),
+        stall_check (),
+        positions (),
+        compression (compression_for_new_downloads),
+        encoding (),
+        signal_error (),
+        metrics_id (Metrics::get ().add_download (url))
     {}
 
     Glib::ustring      url;
@@ -55,8 +156,55 @@ struct Download::Private
     sigc::signal<void> signal_started;
     sigc::signal<void> signal_finished;
     sigc::signal<void> signal_stopped;
-    sigc::connection   check_resumable_connection;
-    sigc::connection   get_size_connection;
+    bool               answered;
+    ChunkPtr           probe;
+    bool               max_chunks_set;
+    gint64             started_at;
+    sigc::connection   window_check;
+    Schedule           schedule;
+    size_t             read_head;
+    bool               read_head_set;
+    PieceMap           pieces;
+    std::vector<std::string> sources;
+
+    // endgame: running chunks, and their duplicates elsewhere
+    std::map<ChunkPtr, ChunkPtr> racers;
+
+    // chunks that failed or are waiting on their host. an entry goes
+    // once its chunk gets data through
+    struct Retry
+    {
+        Retry () :
+            attempts (0),
+            position (0),
+            pending (false),
+            timer ()
+        {}
+
+        unsigned         attempts;  // in a row, without progress
+        size_t           position;  // where the last attempt ended
+        bool             pending;   // timer set, not to be started yet
+        sigc::connection timer;
+    };
+    std::map<ChunkPtr, Retry> retries;
+
+    // sources that refused us
+    std::set<std::string> dead_sources;
+
+    size_t                                   min_speed;
+    sigc::connection                         stall_check;
+
+    // where each running chunk was at each of the last stall_window
+    // seconds, oldest first
+    std::map<ChunkPtr, std::deque<size_t> >  positions;
+
+    // what the server answered with, if we asked for it compressed
+    Compression                              compression;
+    std::string                              encoding;
+
+    sigc::signal<void, Gio::Error> signal_error;
+
+    Metrics::Id        metrics_id;
 };
 
 // constructor
@@ -66,11 +214,51 @@ Download::Download (const Glib::ustring &url,
     sigc::trackable (),
     _priv (new Private (url, dirname, filename))
 {
+    _priv->fileio.connect_signal_drained
+        (sigc::mem_fun (*this, &Download::on_fileio_drained));
+    _priv->fileio.connect_signal_error
+        (sigc::mem_fun (*this, &Download::on_fileio_error));
+    _priv->fileio.connect_signal_finished
+        (sigc::mem_fun (*this, &Download::on_fileio_finished));
+}
+
+Download::Download (const Glib::ustring &url, int fd) :
+    sigc::trackable (),
+    _priv (new Private (url, fd))
+{
+    _priv->fileio.connect_signal_drained
+        (sigc::mem_fun (*this, &Download::on_fileio_drained));
+    _priv->fileio.connect_signal_error
+        (sigc::mem_fun (*this, &Download::on_fileio_error));
+    _priv->fileio.connect_signal_finished
+        (sigc::mem_fun (*this, &Download::on_fileio_finished));
 }
 
 // destructor
 Download::~Download ()
 {
+    // the IOQueue runs the main loop while it finishes its writes, and
+    // by then the rest of _priv may be gone. so nothing may call back
+    // into us: stop the chunks, drop the timers, and cut every slot
+    // bound to us, the chunks' and the IOQueue's included
+    stop ();
+    _priv->window_check.disconnect ();
+    _priv->stall_check.disconnect ();
+    for (std::map<ChunkPtr, Private::Retry>::iterator i =
+             _priv->retries.begin ();
+         i != _priv->retries.end (); ++i)
+        i->second.timer.disconnect ();
+    notify_callbacks ();
+
+    // anything still holding on to a chunk mustn't write to us
+    for (chunk_list_t::iterator i = _priv->chunks.begin ();
+         i != _priv->chunks.end (); ++i)
+        (*i)->sink (NULL);
+    for (std::map<ChunkPtr, ChunkPtr>::iterator i = _priv->racers.begin ();
+         i != _priv->racers.end (); ++i)
+        i->second->sink (NULL);
+
+    Metrics::get ().remove_download (_priv->metrics_id);
 }
 
     // increase number of chunks by num_chunks
@@ -90,12 +278,29 @@ void Download::add_chunks (unsigned short num_chunks)
         ChunkPtr chunk = Chunk::create (url(), 0);
         _priv->chunks.push_back (chunk);
         connect_chunk_signals (chunk);
-        chunk->start ();
+
+        // a compressed answer has to be the one we go by, so there's no
+        // racing it
+        if (_priv->compression != NONE) {
+            chunk->accept_encoding (Decoder::accepted ());
+            start_chunk (chunk);
+            return;
+        }
+
+        start_chunk (chunk);
+
+        // race a one byte request against it to find out sooner
+        start_probe ();
         return;
     } else if (!resumable () || size () == 0)
         // if !resumable, no point adding
         return;
 
+    if (_priv->schedule == SEQUENTIAL) {
+        add_sequential_chunks (num_chunks);
+        return;
+    }
+
     // ! _priv->chunks.empty ()
     // look for largest undownloaded gap
     for (chunk_list_t::iterator i = _priv->chunks.begin ();
@@ -133,6 +338,51 @@ void Download::add_chunks (unsigned short num_chunks)
                     biggest_gaps.front ().second);
 }
 
+    // split chunks off just ahead of the read head
+void Download::add_sequential_chunks (unsigned short num_chunks)
+{
+    size_t head = read_head ();
+
+    // streams pause whatever gets too far ahead, so don't bother
+    size_t limit = size ();
+    if (_priv->fileio.streaming ())
+        limit = std::min (limit, head + _priv->fileio.window ());
+
+    for (; num_chunks > 0; --num_chunks) {
+        // the first chunk past the head with more than a piece left.
+        // it keeps the piece, and a new chunk takes the rest. the new
+        // one is split the same way next time round. a chunk that
+        // hasn't got to the head yet (it moved) is split at the head
+        chunk_list_t::iterator i, next;
+        size_t next_offset = 0;
+        size_t split = 0;
+
+        for (i = _priv->chunks.begin (); i != _priv->chunks.end (); ++i) {
+            next = i;
+            ++next;
+            next_offset = next == _priv->chunks.end () ?
+                size () : (*next)->offset ();
+
+            if (next_offset <= head)
+                continue;
+
+            size_t current = (*i)->current_pos ();
+            split = head > current ? _priv->pieces.align_down (head) : 0;
+            if (split <= current)
+                split = _priv->pieces.align_up
+                    (current + sequential_chunk_size);
+
+            if (split < next_offset)
+                break;
+        }
+
+        if (i == _priv->chunks.end () || split >= limit)
+            return;
+
+        add_chunks (1, next_offset - split, next);
+    }
+}
+
     // add num_chunks for given gap size at iter location
 void Download::add_chunks (unsigned short num_chunks,
                            size_t gap_size,
@@ -142,22 +392,39 @@ void Download::add_chunks (unsigned short num_chunks,
         size () : (*iter)->offset ();
     size_t size_per_chunk = gap_size / num_chunks;
 
-    for (unsigned short i = 0;
-         i < num_chunks;
-         ++i)
-    {
-        new_chunk_offset -= size_per_chunk;
-        ChunkPtr chunk = Chunk::create (url(), new_chunk_offset,
-                                        size_per_chunk);
+    // the chunk before keeps whatever it has already got
+    size_t start = 0;
+    if (iter != _priv->chunks.begin ()) {
+        chunk_list_t::iterator previous = iter;
+        start = (*--previous)->current_pos ();
+    }
+
+    unsigned short added = 0;
+    for (; added < num_chunks; ++added) {
+        // whole pieces only, so a gap too small for one isn't split
+        size_t offset =
+            _priv->pieces.align_down (new_chunk_offset - size_per_chunk);
+        if (offset <= start || offset >= new_chunk_offset)
+            break;
+
+        ChunkPtr chunk = Chunk::create (pick_source (), offset,
+                                        new_chunk_offset - offset);
         iter = _priv->chunks.insert (iter, chunk);
         connect_chunk_signals (chunk);
-        chunk->start ();
+        start_chunk (chunk);
+
+        new_chunk_offset = offset;
     }
 
+    if (!added)
+        return;
+
+    Metrics::get ().chunks_split (added);
+
     // set the previous chunk's new total to be downloaded
     if (iter != _priv->chunks.begin ()) {
         iter--;
-        (*iter)->target_pos (new_chunk_offset - (*iter)->offset ());
+        (*iter)->target_pos (new_chunk_offset);
     }
 }
 
@@ -175,10 +442,23 @@ void Download::start ()
     // already started, don't do anything
     if (_priv->running) return;
 
+    // first start: plan the chunk count from what we know about the host,
+    // unless we've been told otherwise
+    if (_priv->chunks.empty ()) {
+        _priv->started_at = g_get_monotonic_time ();
+
+        unsigned short planned = HostInfo::get ().planned_chunks (url ());
+        if (planned && !_priv->max_chunks_set)
+            _priv->max_chunks = planned;
+    }
+
     // set status and wake up all the chunks
     _priv->running = true;
     normalize_chunks ();
 
+    _priv->stall_check = Glib::signal_timeout ().connect_seconds
+        (sigc::mem_fun (*this, &Download::on_stall_check), 1);
+
     _priv->signal_started.emit ();
 }
 
@@ -189,11 +469,31 @@ void Download::stop ()
 
     // set status and stop all chunks
     _priv->running = false;
+    if (_priv->probe) {
+        _priv->probe->stop ();
+        _priv->probe.reset ();
+    }
+
     for (chunk_list_t::iterator i = _priv->chunks.begin ();
          i != _priv->chunks.end ();
          i++)
         (*i)->stop ();
 
+    for (std::map<ChunkPtr, ChunkPtr>::iterator i = _priv->racers.begin ();
+         i != _priv->racers.end (); ++i)
+        i->second->stop ();
+    _priv->racers.clear ();
+
+    // whatever comes of them will have to wait for the next start
+    for (std::map<ChunkPtr, Private::Retry>::iterator i =
+             _priv->retries.begin ();
+         i != _priv->retries.end (); ++i)
+        i->second.timer.disconnect ();
+    _priv->retries.clear ();
+
+    _priv->stall_check.disconnect ();
+    _priv->positions.clear ();
+
     _priv->signal_stopped.emit ();
 }
 
@@ -220,7 +520,11 @@ unsigned short Download::max_chunks () const
 void Download::max_chunks (unsigned short max_chunks)
 {
     _priv->max_chunks = max_chunks;
-    normalize_chunks ();
+    _priv->max_chunks_set = true;
+
+    // don't kick off any chunks until start () is called
+    if (running ())
+        normalize_chunks ();
 }
 
 Glib::ustring Download::url () const
@@ -231,6 +535,92 @@ Glib::ustring Download::url () const
 void Download::url (const Glib::ustring &url)
 {
     _priv->url = url;
+    _priv->sources[0] = url.raw ();
+}
+
+void Download::add_source (const Glib::ustring &url)
+{
+    if (std::find (_priv->sources.begin (), _priv->sources.end (),
+                   url.raw ()) == _priv->sources.end ())
+        _priv->sources.push_back (url.raw ());
+}
+
+size_t Download::default_min_speed ()
+{
+    return min_speed_for_new_downloads;
+}
+
+void Download::default_min_speed (size_t bytes_per_sec)
+{
+    min_speed_for_new_downloads = bytes_per_sec;
+}
+
+size_t Download::min_speed () const
+{
+    return _priv->min_speed;
+}
+
+void Download::min_speed (size_t bytes_per_sec)
+{
+    _priv->min_speed = bytes_per_sec;
+}
+
+Download::Compression Download::default_compression ()
+{
+    return compression_for_new_downloads;
+}
+
+void Download::default_compression (Compression compression)
+{
+    compression_for_new_downloads = compression;
+}
+
+Download::Compression Download::compression () const
+{
+    return _priv->compression;
+}
+
+void Download::compression (Compression compression)
+{
+    _priv->compression = compression;
+}
+
+std::string Download::content_encoding () const
+{
+    return _priv->encoding;
+}
+
+const Yatta::PieceMap &Download::pieces () const
+{
+    return _priv->pieces;
+}
+
+Download::Schedule Download::schedule () const
+{
+    return _priv->schedule;
+}
+
+void Download::schedule (Schedule schedule)
+{
+    _priv->schedule = schedule;
+}
+
+size_t Download::read_head () const
+{
+    if (_priv->read_head_set)
+        return _priv->read_head;
+
+    return _priv->fileio.cursor ();
+}
+
+void Download::read_head (size_t offset)
+{
+    _priv->read_head = offset;
+    _priv->read_head_set = true;
+
+    // don't kick off any chunks until start () is called
+    if (running ())
+        normalize_chunks ();
 }
 
 bool Download::resumable () const
@@ -238,6 +628,11 @@ bool Download::resumable () const
     return _priv->resumable;
 }
 
+bool Download::running () const
+{
+    return _priv->running;
+}
+
 size_t Download::size () const
 {
     return _priv->size;
@@ -261,8 +656,16 @@ Download::connect_signal_finished (const sigc::slot<void> &slot)
     return _priv->signal_finished.connect (slot);
 }
 
+sigc::connection
+Download::connect_signal_error (const sigc::slot<void, Gio::Error> &slot)
+{
+    return _priv->signal_error.connect (slot);
+}
+
 void Download::normalize_chunks ()
 {
+    YATTA_TRACE_SCOPE ("Download::normalize_chunks");
+
     if (_priv->chunks.empty ()) {
         // no chunks yet. start the first chunk and return. we will be
         // called again when the resumable status is found
@@ -287,13 +690,14 @@ void Download::normalize_chunks ()
                 for (chunk_list_t::iterator i = _priv->chunks.begin ();
                      i != _priv->chunks.end ();
                      i++)
-                    (*i)->start ();
+                    start_chunk (*i);
 
             // all existing chunks are now running
             // running_chunks = total_chunks;
 
             // add remaining chunks to reach maximum
-            add_chunks (max_chunks - total_chunks);
+            if (max_chunks > total_chunks)
+                add_chunks (max_chunks - total_chunks);
         } else if (max_chunks < total_chunks &&
                    running_chunks < max_chunks) {
             // start first (max_chunks - running_chunks) chunks. if they
@@ -302,79 +706,578 @@ void Download::normalize_chunks ()
                  running_chunks < max_chunks &&
                      i != _priv->chunks.end ();
                  i++, running_chunks++)
-                (*i)->start ();
+                start_chunk (*i);
         }
     } else // running_chunks > max_chunks
         stop_chunks (running_chunks - max_chunks);
+
+    start_endgame ();
+
+    Metrics::get ().download_chunks (_priv->metrics_id,
+                                     this->running_chunks ());
+}
+
+std::string Download::pick_source (const std::string &exclude) const
+{
+    std::string best = _priv->sources.front ();
+    size_t best_load = std::numeric_limits<size_t>::max ();
+
+    for (std::vector<std::string>::const_iterator source =
+             _priv->sources.begin ();
+         source != _priv->sources.end (); ++source) {
+        if (*source == exclude || _priv->dead_sources.count (*source))
+            continue;
+
+        size_t load = 0;
+        for (chunk_list_t::const_iterator i = _priv->chunks.begin ();
+             i != _priv->chunks.end (); ++i)
+            if ((*i)->running () && (*i)->url () == *source)
+                ++load;
+
+        for (std::map<ChunkPtr, ChunkPtr>::const_iterator i =
+                 _priv->racers.begin ();
+             i != _priv->racers.end (); ++i)
+            if (i->second->url () == *source)
+                ++load;
+
+        if (load < best_load) {
+            best = *source;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+void Download::start_endgame ()
+{
+    // racing the same source against itself gains nothing
+    if (_priv->sources.size () < 2 || !resumable () ||
+        _priv->pieces.count () == 0)
+        return;
+
+    int running = running_chunks ();
+    int spare = max_chunks () - running - _priv->racers.size ();
+
+    // only once everything missing is already being fetched
+    if (spare <= 0 || _priv->pieces.missing () > size_t (running) ||
+        !missing_covered ())
+        return;
+
+    for (chunk_list_t::iterator i = _priv->chunks.begin ();
+         spare > 0 && i != _priv->chunks.end (); ++i) {
+        ChunkPtr chunk = *i;
+        size_t end = std::min (chunk->target_pos (), size ());
+
+        if (!chunk->running () || _priv->racers.count (chunk) ||
+            chunk->current_pos () >= end)
+            continue;
+
+        ChunkPtr racer = Chunk::create (pick_source (chunk->url ()),
+                                        chunk->current_pos (),
+                                        end - chunk->current_pos ());
+        racer->sink (this);
+        racer->connect_signal_finished
+            (sigc::mem_fun (*this, &Download::on_racer_finished));
+
+        _priv->racers[chunk] = racer;
+        racer->start ();
+        --spare;
+    }
+}
+
+bool Download::missing_covered () const
+{
+    const PieceMap &pieces = _priv->pieces;
+
+    for (size_t piece = 0; piece < pieces.count (); ++piece) {
+        if (pieces.have (piece))
+            continue;
+
+        // chunks start on piece boundaries and fill in from there, so
+        // the chunk spanning the piece has done whatever of it is done
+        size_t start = piece * pieces.piece_size ();
+        size_t end = std::min (start + pieces.piece_size (), size ());
+
+        chunk_list_t::const_iterator i = _priv->chunks.begin ();
+        for (; i != _priv->chunks.end (); ++i)
+            if ((*i)->running () && (*i)->offset () <= start &&
+                (*i)->current_pos () < end &&
+                std::min ((*i)->target_pos (), size ()) >= end)
+                break;
+
+        if (i == _priv->chunks.end ())
+            return false;
+    }
+
+    return true;
+}
+
+void Download::on_racer_finished (ChunkPtr racer)
+{
+    std::map<ChunkPtr, ChunkPtr>::iterator i = _priv->racers.begin ();
+    for (; i != _priv->racers.end () && i->second != racer; ++i);
+
+    // already decided
+    if (i == _priv->racers.end ())
+        return;
+
+    ChunkPtr original = i->first;
+    _priv->racers.erase (i);
+
+    // lost, or gave up. the original carries on
+    if (racer->current_pos () < racer->target_pos ())
+        return;
+
+    chunk_list_t::iterator place =
+        std::find (_priv->chunks.begin (), _priv->chunks.end (), original);
+    if (place == _priv->chunks.end ())
+        return;
+
+    // won: it takes over the original's range and place
+    original->stop ();
+    _priv->retries.erase (original);
+    _priv->positions.erase (original);
+    racer->merge (original);
+    *place = racer;
+    racer->connect_signal_finished
+        (sigc::mem_fun (*this, &Download::on_chunk_finished));
+
+    on_chunk_finished (racer);
 }
 
 void Download::connect_chunk_signals (ChunkPtr chunk)
 {
-    chunk->connect_signal_write
-        (sigc::mem_fun (*this, &Download::on_chunk_write));
+    chunk->sink (this);
 
     chunk->connect_signal_finished
         (sigc::mem_fun (*this, &Download::on_chunk_finished));
 
-    if (chunk->offset() == 0) {
-        _priv->check_resumable_connection =
-            chunk->connect_signal_write
-            (sigc::hide
-             (sigc::hide
-              (sigc::mem_fun (*this, &Download::chunk_check_resumable))));
-
-        _priv->get_size_connection =
-            chunk->connect_signal_write
-            (sigc::hide
-             (sigc::hide
-              (sigc::mem_fun (*this, &Download::chunk_get_size))));
-    }
+    if (chunk->offset() == 0)
+        chunk->connect_signal_headers
+            (sigc::mem_fun (*this, &Download::on_chunk_headers));
 }
 
-    // slots for interfacing with chunks
-void Download::on_chunk_header (ChunkPtr chunk, void *data,
-                                size_t bytes)
+void Download::start_probe ()
 {
-    (void)chunk;
-    (void)data;
-    (void)bytes;
-    // TODO: if filename is empty, here's where we figure it out
+    // once we know the host, the first chunk's answer is all we need
+    if (_priv->probe ||
+        HostInfo::get ().ranges (url ()) != HostInfo::UNKNOWN)
+        return;
+
+    _priv->probe = Chunk::create (url (), 0, 1);
+    _priv->probe->connect_signal_headers
+        (sigc::mem_fun (*this, &Download::on_chunk_headers));
+    _priv->probe->connect_signal_finished
+        (sigc::mem_fun (*this, &Download::on_probe_finished));
+    _priv->probe->start ();
 }
 
-void Download::chunk_check_resumable (ChunkPtr chunk)
+void Download::on_probe_finished (ChunkPtr chunk)
 {
-    _priv->resumable = chunk->resumable ();
-    normalize_chunks ();
-
-    // we have our data, it's not going to change, so disconnect
-    _priv->check_resumable_connection.disconnect ();
+    if (chunk == _priv->probe)
+        _priv->probe.reset ();
 }
 
-void Download::chunk_get_size (ChunkPtr chunk)
+    // slots for interfacing with chunks
+void Download::on_chunk_headers (ChunkPtr chunk)
 {
-    _priv->size = chunk->content_length ();
-    _priv->get_size_connection.disconnect ();
-    normalize_chunks ();
+    // nothing has been opened if we weren't given a name. go with what
+    // the server suggests, or else the URL
+    if (!_priv->fileio.streaming () && _priv->fileio.filename ().empty ()) {
+        std::string name = chunk->suggested_filename ();
+        _priv->fileio.filename (name.empty () ?
+                                Filename::from_url (url ()) : name);
+    }
+
+    // the probe and the first chunk race each other. the first answer
+    // tells us everything we need to fan out, and it's not going to
+    // change
+    if (!_priv->answered) {
+        _priv->answered = true;
+        _priv->resumable = chunk->resumable ();
+        _priv->size = chunk->total_size ();
+
+        // a compressed answer is never resumable, whatever the host can
+        // do with ranges, so it tells us nothing worth remembering
+        if (chunk->content_encoding ().empty ())
+            HostInfo::get ().ranges (url (), resumable ());
+
+        if (size () > 0)
+            _priv->pieces = PieceMap (size ());
+
+        // a compressed file comes whole, in one chunk, as the chunk
+        // won't have been resumable
+        _priv->encoding = chunk->content_encoding ();
+        if (!_priv->encoding.empty () && _priv->compression == DECODE &&
+            !_priv->fileio.decode (_priv->encoding))
+            g_warning ("Saving %s as sent: cannot decode %s",
+                       url ().c_str (), _priv->encoding.c_str ());
+
+        normalize_chunks ();
+    } else if (chunk->content_encoding () != _priv->encoding) {
+        // a retry has to carry on with more of the same
+        fail ("Encoding changed midway: " + chunk->url ());
+        return;
+    }
+
+    // either way, the probe has nothing left to tell us. if we're in its
+    // own callback, the stop is queued and on_probe_finished cleans up
+    if (_priv->probe) {
+        _priv->probe->stop ();
+        if (chunk != _priv->probe)
+            _priv->probe.reset ();
+    }
 }
 
-void Download::on_chunk_write (ChunkPtr chunk,
+void Download::on_chunk_write (Chunk &chunk,
                                void *data,
                                size_t bytes)
 {
-    _priv->fileio.write (chunk->current_pos (),
+    size_t cursor = _priv->fileio.cursor ();
+    _priv->fileio.write (chunk.current_pos (),
                          data,
                          bytes);
+    _priv->pieces.completed (chunk.current_pos (), bytes);
+    Metrics::get ().download_bytes (_priv->metrics_id, bytes);
+    check_congestion ();
+
+    // data got through, so the host is fine again
+    if (!_priv->retries.empty ()) {
+        std::map<ChunkPtr, Private::Retry>::iterator retry =
+            _priv->retries.find (chunk.shared_from_this ());
+        if (retry != _priv->retries.end () && !retry->second.pending) {
+            HostInfo::get ().succeeded (chunk.url ());
+            _priv->retries.erase (retry);
+        }
+    }
+
+    if (_priv->fileio.streaming ()) {
+        // too far ahead of the reader; the reorder buffer would only
+        // grow. the chunk the cursor is waiting on is never in here
+        size_t next = chunk.current_pos () + bytes;
+        if (next >= _priv->fileio.cursor () + _priv->fileio.window () &&
+            !chunk.paused ()) {
+            chunk.pause ();
+            Metrics::get ().chunk_paused ();
+        }
+
+        // the window moved, so chunks held back may go again. not from
+        // in here, since resuming can call straight back into us
+        if (_priv->fileio.cursor () != cursor &&
+            !_priv->window_check.connected ())
+            _priv->window_check = Glib::signal_idle ().connect
+                (sigc::mem_fun (*this, &Download::on_window_moved));
+    }
+}
+
+bool Download::on_chunk_copy (Chunk &chunk, int fd, size_t bytes)
+{
+    if (!_priv->fileio.copy (chunk.current_pos (), fd, bytes))
+        return false;
+
+    _priv->pieces.completed (chunk.current_pos (), bytes);
+
+    Metrics::get ().download_bytes (_priv->metrics_id, bytes);
+    check_congestion ();
+    return true;
+}
+
+void Download::check_congestion ()
+{
+    // the disk can't keep up, so stop pulling data off the network.
+    // pausing is idempotent, and this catches chunks added meanwhile
+    if (_priv->fileio.congested ())
+        for (chunk_list_t::iterator i = _priv->chunks.begin ();
+             i != _priv->chunks.end ();
+             ++i)
+            if (!(*i)->paused ()) {
+                (*i)->pause ();
+                Metrics::get ().chunk_paused ();
+            }
+}
+
+void Download::start_chunk (ChunkPtr chunk)
+{
+    if (chunk->running () || retry_pending (chunk))
+        return;
+
+    unsigned delay = HostInfo::get ().connect_delay (chunk->url ());
+    if (delay)
+        schedule_start (chunk, delay);
+    else
+        chunk->start ();
+}
+
+void Download::retry_chunk (ChunkPtr chunk)
+{
+    Private::Retry &retry = _priv->retries[chunk];
+    Chunk::Failure failure = chunk->failure ();
+
+    // getting somewhere since last time starts the count over
+    if (chunk->current_pos () > retry.position)
+        retry.attempts = 0;
+    retry.position = chunk->current_pos ();
+    retry.attempts++;
+
+    HostInfo::get ().failed (chunk->url ());
+
+    bool permanent = failure == Chunk::REFUSED ||
+        failure == Chunk::BAD_RANGE || retry.attempts > max_retries;
+    if (!permanent) {
+        schedule_start (chunk, std::max
+                        (retry_delay (retry.attempts, failure),
+                         HostInfo::get ().connect_delay (chunk->url ())));
+        return;
+    }
+
+    g_warning ("Giving up on %s from %s: %s", url ().c_str (),
+               chunk->url ().c_str (), describe (failure));
+    _priv->dead_sources.insert (chunk->url ());
+
+    std::string source = pick_source (chunk->url ());
+    if (_priv->dead_sources.count (source)) {
+        fail (std::string (describe (failure)) + ": " + chunk->url ());
+        return;
+    }
+
+    move_chunk (chunk, source);
+}
+
+void Download::move_chunk (ChunkPtr chunk, const std::string &source)
+{
+    // the replacement takes over what the old chunk has done, and its
+    // place
+    size_t remaining = chunk->target_pos () ==
+        std::numeric_limits<size_t>::max () ?
+        0 : chunk->target_pos () - chunk->current_pos ();
+    ChunkPtr replacement = Chunk::create (source, chunk->current_pos (),
+                                          remaining);
+    if (!_priv->encoding.empty ())
+        replacement->accept_encoding (chunk->accept_encoding ());
+    replacement->merge (chunk);
+
+    chunk_list_t::iterator place =
+        std::find (_priv->chunks.begin (), _priv->chunks.end (), chunk);
+    if (place == _priv->chunks.end ())
+        return;
+
+    _priv->retries.erase (chunk);
+    _priv->positions.erase (chunk);
+    chunk->sink (NULL);
+    *place = replacement;
+    connect_chunk_signals (replacement);
+    start_chunk (replacement);
+}
+
+bool Download::on_stall_check ()
+{
+    std::map<ChunkPtr, std::deque<size_t> > positions;
+    std::vector<std::pair<ChunkPtr, size_t> > rates;
+
+    // only chunks that have been moving data for the whole window count
+    for (chunk_list_t::iterator i = _priv->chunks.begin ();
+         i != _priv->chunks.end (); ++i) {
+        // racing ones are taken care of whichever way the race goes
+        if (!(*i)->running () || (*i)->paused () ||
+            _priv->racers.count (*i))
+            continue;
+
+        std::deque<size_t> &samples = positions[*i];
+        samples.swap (_priv->positions[*i]);
+        samples.push_back ((*i)->current_pos ());
+        if (samples.size () > stall_window + 1)
+            samples.pop_front ();
+
+        if (samples.size () == stall_window + 1)
+            rates.push_back (std::make_pair
+                             (*i, (samples.back () - samples.front ()) /
+                              stall_window));
+    }
+    _priv->positions.swap (positions);
+
+    if (rates.empty ())
+        return true;
+
+    std::vector<size_t> speeds;
+    for (size_t i = 0; i < rates.size (); ++i)
+        speeds.push_back (rates[i].second);
+    std::nth_element (speeds.begin (), speeds.begin () + speeds.size () / 2,
+                      speeds.end ());
+    size_t median = speeds[speeds.size () / 2];
+
+    // with fewer than three there's no telling who's the odd one out
+    for (size_t i = 0; i < rates.size (); ++i) {
+        size_t rate = rates[i].second;
+        if ((_priv->min_speed && rate < _priv->min_speed) ||
+            (rates.size () >= 3 && rate * stall_ratio < median))
+            reconnect_chunk (rates[i].first);
+    }
+
+    return true;
+}
+
+void Download::reconnect_chunk (ChunkPtr chunk)
+{
+    YATTA_TRACE_INSTANT ("Download::reconnect_chunk");
+    Metrics::get ().chunk_reconnected ();
+    _priv->positions.erase (chunk);
+
+    // a transfer dropped halfway leaves its connection closed, so even
+    // the same source gets a fresh one
+    std::string source = pick_source (chunk->url ());
+    chunk->stop ();
+
+    if (source != chunk->url () && !_priv->dead_sources.count (source))
+        move_chunk (chunk, source);
+    else
+        start_chunk (chunk);
+}
+
+void Download::schedule_start (ChunkPtr chunk, unsigned delay)
+{
+    Private::Retry &retry = _priv->retries[chunk];
+    retry.pending = true;
+    retry.timer.disconnect ();
+    retry.timer = Glib::signal_timeout ().connect
+        (sigc::bind (sigc::mem_fun (*this, &Download::on_retry),
+                     Chunk::WPtr (chunk)),
+         delay);
+}
+
+bool Download::retry_pending (const ChunkPtr &chunk) const
+{
+    std::map<ChunkPtr, Private::Retry>::const_iterator retry =
+        _priv->retries.find (chunk);
+    return retry != _priv->retries.end () && retry->second.pending;
+}
+
+bool Download::on_retry (Chunk::WPtr weak)
+{
+    ChunkPtr chunk = weak.lock ();
+    if (!chunk)
+        return false;
+
+    std::map<ChunkPtr, Private::Retry>::iterator retry =
+        _priv->retries.find (chunk);
+    if (retry == _priv->retries.end ())
+        return false;
+    retry->second.pending = false;
+
+    // merged or replaced meanwhile
+    if (!running () || std::find (_priv->chunks.begin (),
+                                  _priv->chunks.end (), chunk) ==
+        _priv->chunks.end ()) {
+        _priv->retries.erase (retry);
+        return false;
+    }
+
+    // this timer is done with, and mustn't be disconnected from in here
+    retry->second.timer = sigc::connection ();
+
+    if (retry->second.attempts)
+        Metrics::get ().chunk_restarted ();
+    start_chunk (chunk);
+    return false;
+}
+
+void Download::fail (const std::string &message)
+{
+    stop ();
+    _priv->signal_error.emit (Gio::Error (Gio::Error::FAILED, message));
+}
+
+void Download::record_host_performance ()
+{
+    // small files say more about latency than about the chunk plan
+    const size_t min_size = 4 * 1024 * 1024;
+
+    double elapsed = (g_get_monotonic_time () - _priv->started_at) / 1e6;
+    if (!resumable () || size () < min_size || elapsed <= 0)
+        return;
+
+    HostInfo::get ().finished (url (), max_chunks (), size () / elapsed);
+}
+
+bool Download::within_window (ChunkPtr chunk) const
+{
+    return !_priv->fileio.streaming () ||
+        chunk->current_pos () <
+        _priv->fileio.cursor () + _priv->fileio.window ();
+}
+
+void Download::resume_chunks ()
+{
+    // resuming may feed buffered data straight back into on_chunk_write,
+    // so work on a copy of the list
+    chunk_list_t chunks (_priv->chunks);
+    for (chunk_list_t::iterator i = chunks.begin ();
+         i != chunks.end () && !_priv->fileio.congested ();
+         ++i)
+        if (within_window (*i))
+            (*i)->resume ();
+}
+
+void Download::on_fileio_drained ()
+{
+    resume_chunks ();
+}
+
+void Download::on_fileio_error (Gio::Error error)
+{
+    // nothing more will make it to disk, so there's no point fetching
+    // it. the IOQueue won't fire signal_finished after this either
+    stop ();
+    _priv->signal_error.emit (error);
+}
+
+void Download::on_fileio_finished ()
+{
+    _priv->signal_finished.emit ();
+}
+
+bool Download::on_window_moved ()
+{
+    // this idle is done with, and mustn't be disconnected from in here
+    _priv->window_check = sigc::connection ();
+    resume_chunks ();
+
+    return false;
 }
 
 void Download::on_chunk_finished (ChunkPtr chunk)
 {
-    // check if download has completed
+    // beat its racer to it
+    std::map<ChunkPtr, ChunkPtr>::iterator racer =
+        _priv->racers.find (chunk);
+    if (racer != _priv->racers.end () &&
+        chunk->current_pos () >= chunk->target_pos ()) {
+        racer->second->stop ();
+        _priv->racers.erase (racer);
+    }
+
+    if (chunk->current_pos () >= chunk->target_pos ()) {
+        HostInfo::get ().succeeded (chunk->url ());
+        _priv->retries.erase (chunk);
+    }
+
+    // without a Content-Length (chunked, or compressed on the fly) the
+    // size is only known once the first chunk ends cleanly
+    if (chunk->offset () == 0 && size () == 0 &&
+        chunk->failure () == Chunk::NONE &&
+        chunk->target_pos () == std::numeric_limits<size_t>::max ())
+        _priv->size = chunk->current_pos ();
+
+    // check if download has completed. it's finished once it's all on
+    // disk
     if (chunk->offset () == 0 && size () == chunk->current_pos ()) {
+        record_host_performance ();
         stop ();
-        _priv->signal_finished.emit ();
+        _priv->fileio.finish ();
     } else if (chunk->current_pos () < chunk->target_pos ()) {
-        // if ended prematurely, restart chunk
-        chunk->start ();
+        // ended prematurely. a chunk we stopped ourselves stays stopped
+        if (chunk->failure () != Chunk::STOPPED && running ())
+            retry_chunk (chunk);
     } else { // not done. search for next chunk and merge
         chunk_list_t::iterator i;
         for (i = _priv->chunks.begin ();
@@ -390,6 +1293,15 @@ void Download::on_chunk_finished (ChunkPtr chunk)
         if (next != _priv->chunks.end ()) {
             (*next)->merge (chunk);
             _priv->chunks.erase (i);
+            _priv->positions.erase (chunk);
+            Metrics::get ().chunk_merged ();
         }
+
+        // a connection is free: hand it the next piece of work, or
+        // slide the sequential window along
+        if (running ())
+            normalize_chunks ();
     }
+
+    Metrics::get ().download_chunks (_priv->metrics_id, running_chunks ());
 }
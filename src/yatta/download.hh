@@ -18,21 +18,64 @@
 #ifndef YATTA_CURL_DOWNLOAD_H
 #define YATTA_CURL_DOWNLOAD_H
 
-#include <tr1/memory>
+#include <memory>
 #include <list>
 #include <glibmm/ustring.h>
 #include <glibmm/refptr.h>
+#include <giomm/error.h>
 
 #include "chunk.hh"
+#include "piecemap.hh"
+#include "pool.hh"
 
 namespace Yatta
 {
-    class Download : public sigc::trackable
+    class Download : public sigc::trackable, public ChunkSink
     {
     public:
+        // how new chunks are placed. LARGEST_GAP splits the biggest
+        // stretches left, which is quickest overall. SEQUENTIAL keeps a
+        // window of sequential_chunk_size chunks just past the read head,
+        // for someone reading the file while it downloads
+        enum Schedule
+        {
+            LARGEST_GAP,
+            SEQUENTIAL
+        };
+
+        static const size_t sequential_chunk_size = 4 * 1024 * 1024;
+
+        // NONE fetches the file as it is. otherwise it's asked for
+        // compressed, which the server may or may not do. if it does,
+        // the file comes whole in one chunk; DECODE decompresses it on
+        // its way to disk, KEEP saves it as sent
+        enum Compression
+        {
+            NONE,
+            DECODE,
+            KEEP
+        };
+
+        // a chunk failing this many times in a row without getting
+        // anywhere gives up on its source, and the download with it if
+        // there's no other
+        static const unsigned max_retries = 8;
+
+        // a chunk is reconnected, to another source if there is one,
+        // when over the last stall_window seconds it got less than
+        // min_speed () bytes/s, or stall_ratio times less than the median
+        // of the others
+        static const unsigned stall_window = 10;
+        static const unsigned stall_ratio = 8;
+
         Download (const Glib::ustring &url,
                   const std::string &dirname,
                   const std::string &filename = "");
+
+        // stream the data to fd in order, instead of saving a file.
+        // fd is left open
+        Download (const Glib::ustring &url, int fd);
+
         virtual ~Download ();
 
         void start ();
@@ -46,6 +89,40 @@ namespace Yatta
         Glib::ustring url () const;
         void url (const Glib::ustring &url);
 
+        // another URL with the same file. new chunks go to whichever
+        // source has the fewest, and once nothing is left to split, the
+        // chunks still going are raced against other sources
+        void add_source (const Glib::ustring &url);
+
+        // what's done, in whole pieces. empty until the size is known
+        const PieceMap &pieces () const;
+
+        // 0 leaves only the comparison with the other chunks. new
+        // downloads start with default_min_speed ()
+        static size_t default_min_speed ();
+        static void default_min_speed (size_t bytes_per_sec);
+        size_t min_speed () const;
+        void min_speed (size_t bytes_per_sec);
+
+        // only has any effect before the first start (). new downloads
+        // start with default_compression ()
+        static Compression default_compression ();
+        static void default_compression (Compression compression);
+        Compression compression () const;
+        void compression (Compression compression);
+
+        // what the server compressed the file with, empty if nothing
+        std::string content_encoding () const;
+
+        // streams default to SEQUENTIAL, files to LARGEST_GAP
+        Schedule schedule () const;
+        void schedule (Schedule schedule);
+
+        // where the consumer is reading. follows the stream cursor
+        // unless set
+        size_t read_head () const;
+        void read_head (size_t offset);
+
         bool resumable() const;
         bool running () const;
 
@@ -58,14 +135,20 @@ namespace Yatta
         connect_signal_stopped (const sigc::slot<void> &slot);
         sigc::connection
         connect_signal_finished (const sigc::slot<void> &slot);
+        sigc::connection
+        connect_signal_error (const sigc::slot<void, Gio::Error> &slot);
 
     private:
-        typedef std::list<ChunkPtr> chunk_list_t;
+        // splits and merges reuse the nodes
+        typedef std::list<ChunkPtr, PoolAllocator<ChunkPtr> > chunk_list_t;
 
     protected:
         // increase number of chunks by num_chunks
         void add_chunks (unsigned short num_chunks);
 
+        // split num_chunks chunks off the gaps nearest the read head
+        void add_sequential_chunks (unsigned short num_chunks);
+
         // add num_chunks chunks in front of iter
         void add_chunks (unsigned short num_chunks,
                          size_t gap_size,
@@ -76,26 +159,72 @@ namespace Yatta
 
         void normalize_chunks ();
 
+        // the source with the fewest running chunks, other than exclude
+        std::string pick_source (const std::string &exclude = "") const;
+
+        // duplicate the last running chunks on other sources; whichever
+        // gets to the end first wins
+        void start_endgame ();
+
+        // whether every piece still missing lies in a running chunk's
+        // stretch
+        bool missing_covered () const;
+
         void connect_chunk_signals (ChunkPtr chunk);
 
+        // ask for the first byte only, to learn the size and whether
+        // ranges work while the first chunk is still getting going
+        void start_probe ();
+
+        // pause every chunk while the disk catches up
+        void check_congestion ();
+
+        // start chunk now, or later if its host is being left alone
+        void start_chunk (ChunkPtr chunk);
+
+        // a chunk ended short: back off and start it again, move it to
+        // another source, or give up
+        void retry_chunk (ChunkPtr chunk);
+        void schedule_start (ChunkPtr chunk, unsigned delay);
+        bool retry_pending (const ChunkPtr &chunk) const;
+        void fail (const std::string &message);
+
+        // carry on with what's left of a stopped chunk from source
+        void move_chunk (ChunkPtr chunk, const std::string &source);
+
+        // once a second: drop and reconnect chunks that have stalled
+        bool on_stall_check ();
+        void reconnect_chunk (ChunkPtr chunk);
+
+        // tell HostInfo how well this download went
+        void record_host_performance ();
+
         // use weak_ptr for the functions below to avoid circular
         // dependencies preventing Chunk from destruction
-        virtual void on_chunk_header (ChunkPtr chunk,
-                                      void *data,
-                                      size_t bytes);
+        virtual void on_chunk_headers (ChunkPtr chunk);
         virtual void on_chunk_progress (ChunkPtr chunk,
                                         double dltotal,
                                         double dlnow);
-        virtual void on_chunk_write (ChunkPtr chunk,
+        virtual void on_chunk_write (Chunk &chunk,
                                      void *data,
                                      size_t bytes);
+        virtual bool on_chunk_copy (Chunk &chunk, int fd, size_t bytes);
         virtual void on_chunk_finished (ChunkPtr chunk);
-        void chunk_check_resumable (ChunkPtr chunk);
-        void chunk_get_size (ChunkPtr chunk);
+        void on_racer_finished (ChunkPtr racer);
+        void on_probe_finished (ChunkPtr chunk);
+        void on_fileio_drained ();
+        void on_fileio_error (Gio::Error error);
+        void on_fileio_finished ();
+        bool on_window_moved ();
+        bool on_retry (Chunk::WPtr chunk);
+
+        // when streaming, chunks too far ahead of the cursor stay paused
+        bool within_window (ChunkPtr chunk) const;
+        void resume_chunks ();
 
     private:
         struct Private;
-        std::tr1::shared_ptr<Private> _priv;
+        std::unique_ptr<Private> _priv;
     };
 }
 
@@ -0,0 +1,338 @@
+/* chunk.cc -- chunks of local (or NFS mounted) files
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sigc++/bind.h>
+#include <glibmm/main.h>
+
+#include "chunk.hh"
+#include "../workerpool.hh"
+
+using Yatta::File::Chunk;
+
+// the open file, shared with the jobs working on it
+struct Chunk::Source
+{
+    Source () :
+        fd (-1),
+        size (0),
+        error (0)
+    {}
+
+    ~Source ()
+    {
+        if (fd >= 0)
+            close (fd);
+    }
+
+    // written by the open job, read once its done slot runs
+    int    fd;
+    size_t size;
+    int    error;
+};
+
+// one step that couldn't be copied
+struct Chunk::Read
+{
+    Read (size_t offset, size_t size) :
+        offset (offset),
+        buffer (size),
+        got (0),
+        error (0)
+    {}
+
+    size_t            offset;
+    std::vector<char> buffer;
+    size_t            got;
+    int               error;
+};
+
+struct Chunk::Private
+{
+    Private () :
+        source (new Source),
+        opening (false),
+        reading (false),
+        answered (false),
+        generation (0),
+        step ()
+    {}
+
+    SourcePtr        source;
+    bool             opening;
+    bool             reading;
+    bool             answered;
+
+    // bumped by stop (), so that reads done since are ignored
+    unsigned         generation;
+    sigc::connection step;
+};
+
+const size_t Chunk::step_size;
+
+Chunk::Chunk (const std::string &url, size_t offset, size_t size) :
+    ::Yatta::Chunk (url, offset, size),
+    _priv (new Private)
+{
+}
+
+Chunk::~Chunk ()
+{
+    stop ();
+}
+
+void Chunk::start ()
+{
+    if (running ())
+        return;
+
+    // a pause from before the last stop has nothing left to wait for,
+    // and nothing would come along to lift it
+    paused (false);
+
+    signal_started ();
+
+    if (_priv->source->fd >= 0)
+        schedule_step ();
+    else if (!_priv->opening) {
+        // a file that failed to open gets another go
+        _priv->source.reset (new Source);
+        _priv->opening = true;
+
+        WorkerPool::get ().push
+            (sigc::bind (sigc::ptr_fun (&Chunk::open_source),
+                         _priv->source, url ()),
+             sigc::bind (sigc::ptr_fun (&Chunk::on_opened),
+                         WPtr (std::static_pointer_cast<Chunk>
+                               (shared_from_this ()))));
+    }
+}
+
+void Chunk::stop ()
+{
+    if (!running ())
+        return;
+
+    ++_priv->generation;
+    _priv->reading = false;
+    _priv->step.disconnect ();
+
+    signal_stopped ();
+}
+
+void Chunk::pause ()
+{
+    // on_step notices
+    paused (true);
+}
+
+void Chunk::resume ()
+{
+    if (!paused ())
+        return;
+
+    paused (false);
+    schedule_step ();
+}
+
+bool Chunk::resumable () const
+{
+    return true;
+}
+
+size_t Chunk::content_length () const
+{
+    return end () > offset () ? end () - offset () : 0;
+}
+
+size_t Chunk::total_size () const
+{
+    return _priv->source->size;
+}
+
+size_t Chunk::end () const
+{
+    return std::min (target_pos (), _priv->source->size);
+}
+
+void Chunk::schedule_step ()
+{
+    if (!running () || _priv->opening || _priv->reading ||
+        _priv->step.connected ())
+        return;
+
+    _priv->step = Glib::signal_idle ().connect
+        (sigc::mem_fun (*this, &Chunk::on_step));
+}
+
+// one step per idle, so that the main loop gets a look in
+bool Chunk::on_step ()
+{
+    if (!running () || paused ())
+        return false;
+
+    if (current_pos () >= end ()) {
+        finish ();
+        return false;
+    }
+
+    size_t size = std::min (step_size, end () - current_pos ());
+    if (signal_copy (_priv->source->fd, size))
+        return running ();
+
+    ReadPtr read (new Read (current_pos (), size));
+    _priv->reading = true;
+    WorkerPool::get ().push
+        (sigc::bind (sigc::ptr_fun (&Chunk::read_source),
+                     _priv->source, read),
+         sigc::bind (sigc::ptr_fun (&Chunk::on_read),
+                     WPtr (std::static_pointer_cast<Chunk>
+                           (shared_from_this ())),
+                     read, _priv->generation));
+
+    return false;
+}
+
+void Chunk::finish ()
+{
+    stop ();
+    signal_finished ();
+}
+
+// worker thread
+void Chunk::open_source (SourcePtr source, std::string url)
+{
+    gchar *path = g_filename_from_uri (url.c_str (), NULL, NULL);
+    if (!path) {
+        source->error = EINVAL;
+        return;
+    }
+
+    int fd = open (path, O_RDONLY);
+    g_free (path);
+
+    struct stat info;
+    if (fd < 0 || fstat (fd, &info) != 0) {
+        source->error = errno;
+        if (fd >= 0)
+            close (fd);
+        return;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    source->size = info.st_size;
+    source->fd = fd;
+}
+
+// worker thread
+void Chunk::read_source (SourcePtr source, ReadPtr read)
+{
+    while (read->got < read->buffer.size ()) {
+        ssize_t got = pread (source->fd, &read->buffer[read->got],
+                             read->buffer.size () - read->got,
+                             read->offset + read->got);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            read->error = errno;
+        if (got <= 0)
+            break;
+
+        read->got += got;
+    }
+}
+
+void Chunk::on_opened (WPtr self)
+{
+    std::shared_ptr<Chunk> chunk = self.lock ();
+    if (!chunk)
+        return;
+
+    chunk->_priv->opening = false;
+    if (!chunk->running ())
+        return;
+
+    // ended early: Download decides whether to try again
+    if (chunk->_priv->source->fd < 0) {
+        int error = chunk->_priv->source->error;
+        g_warning ("Could not open %s: %s", chunk->url ().c_str (),
+                   g_strerror (error));
+
+        chunk->failure (error == ENOENT || error == EACCES ||
+                        error == EISDIR || error == EINVAL ?
+                        REFUSED : CONNECTION);
+        chunk->finish ();
+        return;
+    }
+
+    if (!chunk->_priv->answered) {
+        chunk->_priv->answered = true;
+        chunk->signal_headers ();
+    }
+
+    chunk->schedule_step ();
+}
+
+void Chunk::on_read (WPtr self, ReadPtr read, unsigned generation)
+{
+    std::shared_ptr<Chunk> chunk = self.lock ();
+    if (!chunk || chunk->_priv->generation != generation)
+        return;
+
+    chunk->_priv->reading = false;
+
+    // whatever we got is good, and a short read ends us early
+    if (read->got > 0)
+        chunk->signal_write (&read->buffer[0], read->got);
+
+    if (!chunk->running ())
+        return;
+
+    if (read->got < read->buffer.size ()) {
+        // the file is shorter than we were told
+        chunk->failure (read->error ? CONNECTION : BAD_RANGE);
+        chunk->finish ();
+        return;
+    }
+
+    chunk->schedule_step ();
+}
+
+// factory
+Yatta::ChunkPtr
+Yatta::File::ChunkFactory::create_chunk (const std::string &url,
+                                         size_t offset,
+                                         size_t size)
+{
+    return ChunkPtr (new Chunk (url, offset, size));
+}
@@ -0,0 +1,98 @@
+/* chunk.hh -- chunks of local (or NFS mounted) files
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_FILE_CHUNK_H
+#define YATTA_FILE_CHUNK_H
+
+#include <memory>
+
+#include "../chunk.hh"
+
+namespace Yatta
+{
+    namespace File
+    {
+        /**
+         * @brief: A chunk of a file:// URL
+         *
+         * The file is opened on the WorkerPool. Its data is then offered
+         * through signal_copy a step at a time, so that the DiskWriter
+         * can copy it with copy_file_range or sendfile, without it ever
+         * coming through us. Where that's not wanted (streaming), steps
+         * are read on the WorkerPool and handed out through
+         * signal_write like any other chunk's.
+         */
+        class Chunk : public ::Yatta::Chunk
+        {
+        public:
+            static const size_t step_size = 8 * 1024 * 1024;
+
+            Chunk (const std::string &url,
+                   size_t offset,
+                   size_t size);
+            virtual ~Chunk ();
+
+            virtual void start ();
+            virtual void stop ();
+            virtual void pause ();
+            virtual void resume ();
+
+            virtual bool resumable () const;
+            virtual size_t content_length () const;
+            virtual size_t total_size () const;
+
+        private:
+            typedef std::weak_ptr<Chunk> WPtr;
+
+            struct Source;
+            struct Read;
+            typedef std::shared_ptr<Source> SourcePtr;
+            typedef std::shared_ptr<Read> ReadPtr;
+
+            // the end of what we're after: the target, or EOF
+            size_t end () const;
+
+            void schedule_step ();
+            bool on_step ();
+            void finish ();
+
+            // WorkerPool jobs
+            static void open_source (SourcePtr source, std::string url);
+            static void read_source (SourcePtr source, ReadPtr read);
+
+            // these may outlive us, hence the weak pointers
+            static void on_opened (WPtr self);
+            static void on_read (WPtr self, ReadPtr read,
+                                 unsigned generation);
+
+            struct Private;
+            std::unique_ptr<Private> _priv;
+        };
+
+        class ChunkFactory : public ::Yatta::ChunkFactory
+        {
+        public:
+            virtual ~ChunkFactory () noexcept {}
+            virtual ChunkPtr create_chunk (const std::string &url,
+                                           size_t offset,
+                                           size_t size);
+        };
+    }
+}
+
+#endif // YATTA_FILE_CHUNK_H
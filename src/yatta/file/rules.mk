@@ -0,0 +1,3 @@
+libyatta_la_SOURCES += \
+	src/yatta/file/chunk.cc \
+	src/yatta/file/chunk.hh
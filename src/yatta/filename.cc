@@ -0,0 +1,134 @@
+/* filename.cc -- working out what to call a downloaded file
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <strings.h>
+
+#include <glibmm/miscutils.h>
+#include <glibmm/uriutils.h>
+
+#include "filename.hh"
+
+namespace
+{
+    const char *space = " \t\r\n";
+
+    std::string trim (const std::string &value)
+    {
+        size_t start = value.find_first_not_of (space);
+        if (start == std::string::npos)
+            return std::string ();
+
+        return value.substr (start, value.find_last_not_of (space) - start + 1);
+    }
+
+    // value of parameter name in a header like `type; a=b; c="d"'
+    std::string parameter (const std::string &value, const std::string &name)
+    {
+        size_t pos = value.find (';');
+        while (pos != std::string::npos) {
+            size_t start = value.find_first_not_of (space, pos + 1);
+            if (start == std::string::npos)
+                break;
+
+            size_t equals = value.find ('=', start);
+            if (equals == std::string::npos)
+                break;
+
+            std::string key = trim (value.substr (start, equals - start));
+            size_t begin = value.find_first_not_of (space, equals + 1);
+            std::string result;
+
+            if (begin != std::string::npos && value[begin] == '"') {
+                // quoted-string, with backslash escapes
+                for (pos = begin + 1; pos < value.size () && value[pos] != '"';
+                     ++pos) {
+                    if (value[pos] == '\\' && pos + 1 < value.size ())
+                        ++pos;
+                    result += value[pos];
+                }
+                pos = value.find (';', pos);
+            } else {
+                pos = value.find (';', equals);
+                result = trim (value.substr (equals + 1,
+                                             pos == std::string::npos ?
+                                             std::string::npos :
+                                             pos - equals - 1));
+            }
+
+            if (strcasecmp (key.c_str (), name.c_str ()) == 0)
+                return result;
+        }
+
+        return std::string ();
+    }
+}
+
+std::string Yatta::Filename::sanitize (const std::string &name)
+{
+    if (name.empty ())
+        return std::string ();
+
+    std::string base = Glib::path_get_basename (name);
+
+    // windows-ish servers like backslashes
+    size_t backslash = base.rfind ('\\');
+    if (backslash != std::string::npos)
+        base.erase (0, backslash + 1);
+
+    if (base == "." || base == ".." || base == G_DIR_SEPARATOR_S)
+        return std::string ();
+
+    return base;
+}
+
+std::string Yatta::Filename::from_url (const std::string &url)
+{
+    size_t end = url.find_first_of ("?#");
+    if (end == std::string::npos)
+        end = url.size ();
+
+    // nothing after the host
+    size_t scheme_end = url.find ("://");
+    size_t path_start = url.find ('/', scheme_end == std::string::npos ?
+                                  0 : scheme_end + 3);
+    if (path_start == std::string::npos || path_start >= end)
+        return "index.html";
+
+    size_t start = url.rfind ('/', end - 1) + 1;
+
+    std::string name = sanitize (Glib::uri_unescape_string
+                                 (url.substr (start, end - start)));
+
+    return name.empty () ? "index.html" : name;
+}
+
+std::string
+Yatta::Filename::from_content_disposition (const std::string &value)
+{
+    // RFC 5987 form first: filename*=UTF-8''na%20me
+    std::string extended = parameter (value, "filename*");
+    size_t quotes = extended.find ("''");
+    if (quotes != std::string::npos) {
+        std::string name = sanitize (Glib::uri_unescape_string
+                                     (extended.substr (quotes + 2)));
+        if (!name.empty ())
+            return name;
+    }
+
+    return sanitize (parameter (value, "filename"));
+}
@@ -0,0 +1,41 @@
+/* filename.hh -- working out what to call a downloaded file
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_FILENAME_H
+#define YATTA_FILENAME_H
+
+#include <string>
+
+namespace Yatta
+{
+    // everything here returns a bare name, safe to put in a directory
+    namespace Filename
+    {
+        // the last path component of url, unescaped, or index.html
+        std::string from_url (const std::string &url);
+
+        // the filename (or filename*) parameter of a Content-Disposition
+        // header value, empty if there isn't a usable one
+        std::string from_content_disposition (const std::string &value);
+
+        // strip anything that would take name out of its directory
+        std::string sanitize (const std::string &name);
+    }
+}
+
+#endif // YATTA_FILENAME_H
@@ -0,0 +1,347 @@
+/* hostinfo.cc -- what we've learnt about the hosts we download from
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <map>
+#include <ctime>
+
+#include <glibmm/keyfile.h>
+#include <glibmm/main.h>
+#include <glibmm/miscutils.h>
+
+#include "hostinfo.hh"
+
+using Yatta::HostInfo;
+
+namespace
+{
+    // how long a 429/503 makes us go easy on a host
+    const gint64 throttle_memory = 60 * 60;
+
+    // records not touched for this long are dropped on save
+    const gint64 record_lifetime = 30 * 24 * 60 * 60;
+
+    // don't rewrite the file more often than this
+    const unsigned save_delay = 30;
+
+    // how long a tripped breaker stays open, doubling with each failed
+    // trial. milliseconds
+    const unsigned breaker_cooldown = 10 * 1000;
+    const unsigned breaker_max_cooldown = 5 * 60 * 1000;
+
+    // while a trial connection is out, everyone else checks back this
+    // often
+    const unsigned breaker_trial_wait = 1000;
+
+    gint64 now_ms ()
+    {
+        return g_get_monotonic_time () / 1000;
+    }
+
+    gint64 now ()
+    {
+        return std::time (NULL);
+    }
+
+    HostInfo::Support to_support (int value)
+    {
+        switch (value) {
+        case HostInfo::SUPPORTED:   return HostInfo::SUPPORTED;
+        case HostInfo::UNSUPPORTED: return HostInfo::UNSUPPORTED;
+        default:                    return HostInfo::UNKNOWN;
+        }
+    }
+}
+
+struct HostInfo::Private
+{
+    typedef std::map<std::string, Record> record_map_t;
+
+    // closed while failures < breaker_threshold, open until open_until,
+    // then half open until the trial connection reports back
+    struct Breaker
+    {
+        Breaker () :
+            failures (0),
+            cooldown (0),
+            open_until (0),
+            trial_started (0)
+        {}
+
+        unsigned failures;      // in a row
+        unsigned cooldown;      // ms; 0 while closed
+        gint64   open_until;    // monotonic ms
+        gint64   trial_started; // monotonic ms; 0 if none is out
+    };
+    typedef std::map<std::string, Breaker> breaker_map_t;
+
+    Private () :
+        records (),
+        breakers (),
+        path (Glib::build_filename (Glib::get_user_cache_dir (),
+                                    "yatta", "hosts")),
+        dirty (false)
+    {}
+
+    record_map_t     records;
+    breaker_map_t    breakers;
+    std::string      path;
+    bool             dirty;
+    sigc::connection save_connection;
+
+    Record &touch (const std::string &url)
+    {
+        Record &record = records[origin (url)];
+        record.updated = now ();
+        dirty = true;
+
+        if (!save_connection.connected ())
+            save_connection = Glib::signal_timeout ().connect_seconds
+                (sigc::mem_fun (*this, &Private::on_save_timeout),
+                 save_delay);
+
+        return record;
+    }
+
+    bool on_save_timeout ()
+    {
+        HostInfo::get ().save ();
+        return false;
+    }
+};
+
+HostInfo::HostInfo () :
+    _priv (new Private)
+{
+    load ();
+}
+
+HostInfo::~HostInfo ()
+{
+    _priv->save_connection.disconnect ();
+    if (_priv->dirty)
+        save ();
+}
+
+HostInfo &HostInfo::get ()
+{
+    static HostInfo instance;
+    return instance;
+}
+
+std::string HostInfo::origin (const std::string &url)
+{
+    size_t scheme_end = url.find ("://");
+    if (scheme_end == std::string::npos)
+        return std::string ();
+
+    size_t start = scheme_end + 3;
+    size_t end = url.find_first_of ("/?#", start);
+    std::string authority = url.substr (start, end == std::string::npos ?
+                                       std::string::npos : end - start);
+
+    size_t at = authority.rfind ('@');
+    if (at != std::string::npos)
+        authority.erase (0, at + 1);
+
+    return url.substr (0, start) + authority;
+}
+
+HostInfo::Record HostInfo::lookup (const std::string &url) const
+{
+    Private::record_map_t::const_iterator i =
+        _priv->records.find (origin (url));
+
+    return i == _priv->records.end () ? Record () : i->second;
+}
+
+unsigned short HostInfo::planned_chunks (const std::string &url) const
+{
+    Record record = lookup (url);
+
+    if (record.ranges != SUPPORTED || record.best_chunks == 0)
+        return 0;
+
+    // it told us to back off not long ago
+    if (now () - record.last_throttled < throttle_memory)
+        return record.best_chunks > 1 ? record.best_chunks / 2 : 1;
+
+    return record.best_chunks;
+}
+
+HostInfo::Support HostInfo::ranges (const std::string &url) const
+{
+    return lookup (url).ranges;
+}
+
+void HostInfo::ranges (const std::string &url, bool supported)
+{
+    _priv->touch (url).ranges = supported ? SUPPORTED : UNSUPPORTED;
+}
+
+void HostInfo::http2 (const std::string &url, bool supported)
+{
+    _priv->touch (url).http2 = supported ? SUPPORTED : UNSUPPORTED;
+}
+
+void HostInfo::throttled (const std::string &url)
+{
+    Record &record = _priv->touch (url);
+    record.throttled++;
+    record.last_throttled = now ();
+}
+
+const unsigned HostInfo::breaker_threshold;
+
+void HostInfo::failed (const std::string &url)
+{
+    Private::Breaker &breaker = _priv->breakers[origin (url)];
+    breaker.failures++;
+
+    if (breaker.trial_started) {
+        // the trial failed: stay open for longer
+        breaker.trial_started = 0;
+        breaker.cooldown = std::min (breaker.cooldown * 2,
+                                     breaker_max_cooldown);
+        breaker.open_until = now_ms () + breaker.cooldown;
+    } else if (!breaker.cooldown &&
+               breaker.failures >= breaker_threshold) {
+        breaker.cooldown = breaker_cooldown;
+        breaker.open_until = now_ms () + breaker.cooldown;
+    }
+}
+
+void HostInfo::succeeded (const std::string &url)
+{
+    _priv->breakers.erase (origin (url));
+}
+
+unsigned HostInfo::connect_delay (const std::string &url)
+{
+    Private::breaker_map_t::iterator i = _priv->breakers.find (origin (url));
+    if (i == _priv->breakers.end () || !i->second.cooldown)
+        return 0;
+
+    Private::Breaker &breaker = i->second;
+    gint64 now = now_ms ();
+
+    if (now < breaker.open_until)
+        return breaker.open_until - now;
+
+    // one trial at a time, unless it never reported back
+    if (breaker.trial_started &&
+        now - breaker.trial_started < breaker.cooldown)
+        return breaker_trial_wait;
+
+    breaker.trial_started = now;
+    return 0;
+}
+
+void HostInfo::finished (const std::string &url, unsigned short chunks,
+                         double bytes_per_sec)
+{
+    Record &record = _priv->touch (url);
+
+    record.throughput = record.throughput == 0 ? bytes_per_sec :
+        0.7 * record.throughput + 0.3 * bytes_per_sec;
+
+    // keep the best plan, but let its figure follow the host when the
+    // same plan is used again
+    if (bytes_per_sec > record.best_throughput ||
+        chunks == record.best_chunks) {
+        record.best_chunks = chunks;
+        record.best_throughput = bytes_per_sec;
+    }
+}
+
+bool HostInfo::load ()
+{
+    Glib::KeyFile file;
+
+    try {
+        if (!file.load_from_file (_priv->path))
+            return false;
+    } catch (Glib::Error &e) {
+        // no cache yet is fine
+        return false;
+    }
+
+    Glib::ArrayHandle<Glib::ustring> groups = file.get_groups ();
+    for (Glib::ArrayHandle<Glib::ustring>::const_iterator i =
+             groups.begin ();
+         i != groups.end (); ++i) {
+        try {
+            Record record;
+            record.ranges = to_support (file.get_integer (*i, "ranges"));
+            record.http2 = to_support (file.get_integer (*i, "http2"));
+            record.best_chunks = file.get_integer (*i, "best_chunks");
+            record.best_throughput = file.get_double (*i, "best_throughput");
+            record.throughput = file.get_double (*i, "throughput");
+            record.throttled = file.get_integer (*i, "throttled");
+            record.last_throttled = static_cast<gint64>
+                (file.get_double (*i, "last_throttled"));
+            record.updated = static_cast<gint64>
+                (file.get_double (*i, "updated"));
+
+            _priv->records[*i] = record;
+        } catch (Glib::KeyFileError &e) {
+            g_warning ("Ignoring bad host record %s: %s", i->c_str (),
+                       e.what ().c_str ());
+        }
+    }
+
+    return true;
+}
+
+bool HostInfo::save ()
+{
+    Glib::KeyFile file;
+    gint64 cutoff = now () - record_lifetime;
+
+    for (Private::record_map_t::const_iterator i = _priv->records.begin ();
+         i != _priv->records.end (); ++i) {
+        if (i->second.updated < cutoff)
+            continue;
+
+        const Record &record = i->second;
+        file.set_integer (i->first, "ranges", record.ranges);
+        file.set_integer (i->first, "http2", record.http2);
+        file.set_integer (i->first, "best_chunks", record.best_chunks);
+        file.set_double (i->first, "best_throughput",
+                         record.best_throughput);
+        file.set_double (i->first, "throughput", record.throughput);
+        file.set_integer (i->first, "throttled", record.throttled);
+        file.set_double (i->first, "last_throttled", record.last_throttled);
+        file.set_double (i->first, "updated", record.updated);
+    }
+
+    g_mkdir_with_parents (Glib::path_get_dirname (_priv->path).c_str (),
+                          0700);
+
+    Glib::ustring data = file.to_data ();
+    GError *error = NULL;
+    if (!g_file_set_contents (_priv->path.c_str (), data.c_str (),
+                              data.bytes (), &error)) {
+        g_warning ("Could not save host records: %s", error->message);
+        g_error_free (error);
+        return false;
+    }
+
+    _priv->dirty = false;
+    return true;
+}
@@ -0,0 +1,115 @@
+/* hostinfo.hh -- what we've learnt about the hosts we download from
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_HOSTINFO_H
+#define YATTA_HOSTINFO_H
+
+#include <memory>
+#include <string>
+#include <glib.h>
+
+namespace Yatta
+{
+    /**
+     * @brief: Per-origin facts shared by every Download
+     *
+     * Records persist in $XDG_CACHE_HOME/yatta/hosts so that a new
+     * session doesn't have to learn them all over again.
+     */
+    class HostInfo
+    {
+    public:
+        enum Support
+        {
+            UNKNOWN,
+            SUPPORTED,
+            UNSUPPORTED
+        };
+
+        struct Record
+        {
+            Record () :
+                ranges (UNKNOWN),
+                http2 (UNKNOWN),
+                best_chunks (0),
+                best_throughput (0),
+                throughput (0),
+                throttled (0),
+                last_throttled (0),
+                updated (0)
+            {}
+
+            Support        ranges;
+            Support        http2;
+            unsigned short best_chunks;     // chunk count behind...
+            double         best_throughput; // ...the best bytes/s seen
+            double         throughput;      // moving average, bytes/s
+            unsigned long  throttled;       // 429/503 answers seen
+            gint64         last_throttled;  // wall clock, seconds
+            gint64         updated;         // wall clock, seconds
+        };
+
+        static HostInfo &get ();
+
+        // scheme://host[:port] of url, without any user info
+        static std::string origin (const std::string &url);
+
+        // everything known about the origin of url
+        Record lookup (const std::string &url) const;
+
+        // chunk count to start a download with, 0 if we don't know
+        unsigned short planned_chunks (const std::string &url) const;
+
+        // whether the origin of url answers Range requests with a 206
+        Support ranges (const std::string &url) const;
+        void ranges (const std::string &url, bool supported);
+
+        void http2 (const std::string &url, bool supported);
+        void throttled (const std::string &url);
+
+        // circuit breaker, kept for this session only. after
+        // breaker_threshold failures in a row an origin is left alone for
+        // a while. then a single connection is let through, and the rest
+        // wait for it to succeed or fail
+        static const unsigned breaker_threshold = 5;
+        void failed (const std::string &url);
+        void succeeded (const std::string &url);
+
+        // milliseconds to hold off connecting to the origin of url. 0
+        // means go ahead, which may make the caller the trial connection
+        unsigned connect_delay (const std::string &url);
+
+        // a download finished at bytes_per_sec using chunks connections
+        void finished (const std::string &url, unsigned short chunks,
+                       double bytes_per_sec);
+
+        bool load ();
+        bool save ();
+
+        ~HostInfo ();
+
+    private:
+        HostInfo ();
+        HostInfo (const HostInfo &) = delete;
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_HOSTINFO_H
@@ -0,0 +1,275 @@
+/* instance.cc -- handing URLs to a copy of us that's already running
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <map>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <sigc++/bind.h>
+#include <sigc++/signal.h>
+#include <glibmm/main.h>
+#include <glibmm/miscutils.h>
+
+#include "instance.hh"
+#include "unixsocket.hh"
+
+using Yatta::Instance;
+
+namespace
+{
+    // a wedged instance shouldn't hang whoever's handing off to it
+    const int handoff_timeout = 5;
+
+    bool make_address (const std::string &path, sockaddr_un &addr)
+    {
+        if (path.size () >= sizeof (addr.sun_path))
+            return false;
+
+        std::memset (&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy (addr.sun_path, path.c_str ());
+        return true;
+    }
+
+    // -1 if nobody is there
+    int connect_to (const std::string &path)
+    {
+        sockaddr_un addr;
+        if (!make_address (path, addr))
+            return -1;
+
+        int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        if (connect (fd, reinterpret_cast<sockaddr *> (&addr),
+                     sizeof (addr)) < 0) {
+            close (fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    bool send_all (int fd, const std::string &data)
+    {
+        for (size_t sent = 0; sent < data.size ();) {
+            ssize_t n = send (fd, data.data () + sent, data.size () - sent,
+                              MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+
+        return true;
+    }
+}
+
+struct Instance::Private
+{
+    Private () :
+        listen_fd (-1),
+        socket_path (),
+        incoming_connection (),
+        clients (),
+        signal_handoff ()
+    {}
+
+    struct Client
+    {
+        std::string      data;
+        sigc::connection watch;
+    };
+
+    bool on_incoming (Glib::IOCondition)
+    {
+        int fd = accept (listen_fd, NULL, NULL);
+        if (fd < 0)
+            return true;
+
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+        clients[fd].watch = Glib::signal_io ().connect
+            (sigc::bind (sigc::mem_fun (*this, &Private::on_client_data),
+                         fd),
+             fd, Glib::IO_IN | Glib::IO_HUP | Glib::IO_ERR);
+        return true;
+    }
+
+    // read until the sender is done, then act on it all
+    bool on_client_data (Glib::IOCondition, int fd)
+    {
+        Client &client = clients[fd];
+        char buffer[4096];
+
+        for (;;) {
+            ssize_t got = recv (fd, buffer, sizeof (buffer), 0);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            if (got > 0) {
+                client.data.append (buffer, got);
+                continue;
+            }
+
+            // end of the request, or the sender went away
+            std::string data;
+            data.swap (client.data);
+            clients.erase (fd);
+            close (fd);
+
+            size_t newline = data.find ('\n');
+            if (got == 0 && newline != std::string::npos)
+                signal_handoff.emit (data.substr (newline + 1),
+                                     data.substr (0, newline));
+            return false;
+        }
+    }
+
+    int                      listen_fd;
+    std::string              socket_path;
+    sigc::connection         incoming_connection;
+    std::map<int, Client>    clients;
+
+    sigc::signal<void, const std::string &, const std::string &>
+                             signal_handoff;
+};
+
+std::string Instance::socket_path ()
+{
+    return Glib::build_filename (Glib::get_user_runtime_dir (),
+                                 "yatta", "instance");
+}
+
+bool Instance::hand_off (const std::string &urls, const std::string &dirname)
+{
+    int fd = connect_to (socket_path ());
+    if (fd < 0)
+        return false;
+
+    timeval timeout = { handoff_timeout, 0 };
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+    bool sent = send_all (fd, dirname + "\n" + urls);
+    shutdown (fd, SHUT_WR);
+
+    // the listener closes once it has the lot
+    char byte;
+    while (sent && recv (fd, &byte, 1, 0) < 0 && errno == EINTR);
+
+    close (fd);
+    return sent;
+}
+
+Instance::Instance () :
+    _priv (new Private)
+{
+}
+
+Instance::~Instance ()
+{
+    _priv->incoming_connection.disconnect ();
+
+    for (std::map<int, Private::Client>::iterator i =
+             _priv->clients.begin ();
+         i != _priv->clients.end (); ++i) {
+        i->second.watch.disconnect ();
+        close (i->first);
+    }
+
+    if (_priv->listen_fd >= 0) {
+        close (_priv->listen_fd);
+        unlink (_priv->socket_path.c_str ());
+    }
+}
+
+bool Instance::listen ()
+{
+    std::string path = socket_path ();
+    sockaddr_un addr;
+    if (!make_address (path, addr)) {
+        g_warning ("Instance socket path too long: %s", path.c_str ());
+        return false;
+    }
+
+    if (g_mkdir_with_parents (Glib::path_get_dirname (path).c_str (),
+                              0700) != 0) {
+        g_warning ("Could not create %s: %s",
+                   Glib::path_get_dirname (path).c_str (),
+                   g_strerror (errno));
+        return false;
+    }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        g_warning ("Could not create instance socket: %s",
+                   g_strerror (errno));
+        return false;
+    }
+
+    // a socket that's answered belongs to an instance that started
+    // alongside us. one that refuses us is left over from a crash, and
+    // anything else there is not ours to remove
+    int error = bind (fd, reinterpret_cast<sockaddr *> (&addr),
+                      sizeof (addr));
+    if (error < 0 && errno == EADDRINUSE) {
+        int other = connect_to (path);
+        if (other >= 0) {
+            close (other);
+            close (fd);
+            return false;
+        }
+
+        if (UnixSocket::stale (path)) {
+            unlink (path.c_str ());
+            error = bind (fd, reinterpret_cast<sockaddr *> (&addr),
+                          sizeof (addr));
+        } else
+            errno = EADDRINUSE;
+    }
+
+    if (error < 0 || ::listen (fd, 8) < 0) {
+        g_warning ("Could not listen on %s: %s", path.c_str (),
+                   g_strerror (errno));
+        close (fd);
+        return false;
+    }
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    _priv->listen_fd = fd;
+    _priv->socket_path = path;
+    _priv->incoming_connection = Glib::signal_io ().connect
+        (sigc::mem_fun (*_priv, &Private::on_incoming), fd, Glib::IO_IN);
+    return true;
+}
+
+sigc::connection
+Instance::connect_signal_handoff (const HandoffSlot &slot)
+{
+    return _priv->signal_handoff.connect (slot);
+}
@@ -0,0 +1,74 @@
+/* instance.hh -- handing URLs to a copy of us that's already running
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_INSTANCE_H
+#define YATTA_INSTANCE_H
+
+#include <memory>
+#include <string>
+
+#include <sigc++/connection.h>
+#include <sigc++/slot.h>
+
+namespace Yatta
+{
+    /**
+     * @brief: One running Yatta per user, taking URLs from the rest
+     *
+     * The running one listens on a UNIX socket in $XDG_RUNTIME_DIR.
+     * Anything started after it connects there, sends the directory it
+     * was started in and its URLs, and exits without setting up curl or
+     * gtk. A browser handing over a link then costs next to nothing.
+     *
+     * On the wire: the directory on the first line, then the URLs in
+     * the format Queue::import () reads. The sender closes its end when
+     * done and waits for the listener to close too.
+     */
+    class Instance
+    {
+    public:
+        // urls, in Queue::import () format
+        typedef sigc::slot<void, const std::string & /* urls */,
+                           const std::string & /* dirname */> HandoffSlot;
+
+        // $XDG_RUNTIME_DIR/yatta/instance
+        static std::string socket_path ();
+
+        // false if nobody is listening, in which case it's up to us
+        static bool hand_off (const std::string &urls,
+                              const std::string &dirname);
+
+        Instance ();
+        ~Instance ();
+
+        // start taking handoffs. false if someone else already is, or
+        // the socket couldn't be set up
+        bool listen ();
+
+        // an empty list of urls means someone just wanted us to show up
+        sigc::connection connect_signal_handoff (const HandoffSlot &slot);
+
+    private:
+        Instance (const Instance &) = delete;
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_INSTANCE_H
@@ -17,109 +17,557 @@
 
 #include <giomm.h>
 #include <queue>
+#include <map>
+#include <cerrno>
 #include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sigc++/bind.h>
+
 #include "ioqueue.hh"
+#include "decoder.hh"
+#include "directwriter.hh"
+#include "writeback.hh"
+#include "diskwriter.hh"
+#include "workerpool.hh"
+#include "metrics.hh"
+#include "trace.hh"
+
+namespace
+{
+    // these run on the WorkerPool, and only touch what they're given
+
+    Yatta::IOQueue::Mode mode_for_new_queues = Yatta::IOQueue::BUFFERED;
+
+    void open_file (std::string dirname, std::string path, bool direct,
+                    int *fd, int *direct_fd, int *error)
+    {
+        *fd = *direct_fd = -1;
+
+        if (g_mkdir_with_parents (dirname.c_str (), 0755) != 0) {
+            *error = errno;
+            return;
+        }
+
+        *fd = ::open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        *error = *fd < 0 ? errno : 0;
+
+#ifdef O_DIRECT
+        // a second descriptor for the aligned blocks. not every
+        // filesystem can do direct I/O, in which case we do without
+        if (*fd >= 0 && direct)
+            *direct_fd = ::open (path.c_str (), O_WRONLY | O_DIRECT);
+#else
+        (void) direct;
+#endif
+    }
+
+    void close_file (int fd)
+    {
+        close (fd);
+    }
+
+    Gio::Error errno_error (int error)
+    {
+        return Gio::Error (static_cast<Gio::Error::Code>
+                           (g_io_error_from_errno (error)),
+                           g_strerror (error));
+    }
+}
 
 namespace Yatta
 {
-    struct IOQueue::Private
+    struct IOQueue::Private : public DiskWriter::Client
     {
+        typedef DiskWriter::Request Request;
+
         Private (const std::string &dirname,
-                 const std::string &filename) :
+                 const std::string &filename,
+                 Mode mode) :
             dirname (dirname),
             filename (filename),
+            mode (mode),
+            fd (-1),
+            direct_fd (-1),
+            direct (),
+            writeback (),
+            decoder (),
+            written (false),
+            error (0),
+            opening (false),
+            failed (false),
             queue (),
-            handle (),
-            loop (Glib::MainLoop::create ()),
-            signal_error ()
+            in_flight (0),
+            stream (false),
+            cursor (0),
+            window (default_window),
+            reorder (),
+            reordered (0),
+            signal_error (),
+            signal_drained (),
+            signal_finished (),
+            pending (0),
+            max_pending (default_max_pending),
+            congested (false)
         {}
 
-        struct Item
+        Request *make_request (Request::Kind kind, size_t offset,
+                               const void *data, size_t size)
         {
-            Item (size_t offset, void *data, size_t size) :
-                offset (offset),
-                data (NULL),
-                size (size)
-            {
-                this->data = operator new (size);
-                std::memcpy (this->data, data, size);
+            Request *request = new Request ();
+            request->kind = kind;
+            request->offset = offset;
+            request->size = size;
+            request->source = -1;
+            request->owner = this;
+
+            if (size) {
+                char *copy = static_cast<char *> (operator new (size));
+                std::memcpy (copy, data, size);
+                request->data = copy;
             }
 
-            size_t offset;
-            void * data;
-            size_t size;
-        };
+            return request;
+        }
+
+        void free_request (Request *request)
+        {
+            operator delete (const_cast<char *> (request->data));
+            if (request->source >= 0)
+                close (request->source);
+            delete request;
+        }
+
+        // next in line to go out
+        void queue_next (Request *request)
+        {
+            queue.push (request);
+            pending += request->size;
+            cursor += request->size;
+        }
+
+        // streaming: queue whatever continues from the cursor, and hold
+        // on to the rest
+        void stream_write (size_t offset, const void *data, size_t size)
+        {
+            // already out. chunks don't overlap, so this shouldn't
+            // happen, but there's no getting it back either way
+            if (offset + size <= cursor)
+                return;
+
+            if (offset > cursor) {
+                Request *&held = reorder[offset];
+                if (held) {
+                    Metrics::get ().write_dropped (held->size);
+                    reordered -= held->size;
+                    free_request (held);
+                }
+
+                held = make_request (Request::APPEND, offset, data, size);
+                reordered += size;
+                Metrics::get ().write_queued (size);
+                return;
+            }
+
+            size_t skip = cursor - offset;
+            Metrics::get ().write_queued (size - skip);
+            queue_next (make_request (Request::APPEND, cursor,
+                                      static_cast<const char *> (data) +
+                                      skip, size - skip));
+
+            // and whatever was waiting for that gap to close
+            while (!reorder.empty () && reorder.begin ()->first <= cursor) {
+                Request *held = reorder.begin ()->second;
+                reorder.erase (reorder.begin ());
+                reordered -= held->size;
+
+                if (held->offset + held->size <= cursor) {
+                    Metrics::get ().write_dropped (held->size);
+                    free_request (held);
+                    continue;
+                }
+
+                skip = cursor - held->offset;
+                if (skip) {
+                    char *data = const_cast<char *> (held->data);
+                    std::memmove (data, data + skip, held->size - skip);
+                    held->offset = cursor;
+
+                    // only what's left of it is still on its way out
+                    Metrics::get ().write_dropped (held->size);
+                    held->size -= skip;
+                    Metrics::get ().write_queued (held->size);
+                }
+
+                queue_next (held);
+            }
+        }
+
+        // hand everything waiting over to the DiskWriter
+        void submit ()
+        {
+            YATTA_TRACE_SCOPE ("IOQueue::perform");
+            YATTA_TRACE_COUNTER ("IOQueue depth",
+                                 queue.size () + in_flight);
+
+            if (fd < 0 || failed)
+                return;
+
+            for (; !queue.empty (); queue.pop ()) {
+                Request *request = queue.front ();
+                request->fd = fd;
+                request->direct = direct.get ();
+                request->writeback = writeback.get ();
+                request->decoder = decoder.get ();
+
+                ++in_flight;
+                DiskWriter::get ().submit (request);
+            }
+        }
+
+        // give up on the file: nothing queued will ever be written
+        void fail ()
+        {
+            failed = true;
+
+            drop_held ();
+            pending = 0;
+        }
+
+        // free everything not yet handed over
+        void drop_held ()
+        {
+            for (; !queue.empty (); queue.pop ()) {
+                Metrics::get ().write_dropped (queue.front ()->size);
+                free_request (queue.front ());
+            }
+
+            for (std::map<size_t, Request *>::iterator i = reorder.begin ();
+                 i != reorder.end (); ++i) {
+                Metrics::get ().write_dropped (i->second->size);
+                free_request (i->second);
+            }
+            reorder.clear ();
+            reordered = 0;
+        }
+
+        // let producers go again once we're down to half the budget, so
+        // that we don't flap around the limit
+        void check_drained ()
+        {
+            if (congested && pending <= max_pending / 2) {
+                congested = false;
+                signal_drained.emit ();
+            }
+        }
+
+        virtual void on_write_done (Request &request)
+        {
+            YATTA_TRACE_SCOPE ("IOQueue::perform_finish");
+            YATTA_TRACE_COMPLETE ("IOQueue write", request.started,
+                                  request.finished - request.started);
+
+            --in_flight;
+
+            if (request.size > 0 && !request.error)
+                Metrics::get ().write_done (request.size,
+                                            (request.finished -
+                                             request.started) / 1e6);
+            else if (request.size > 0)
+                Metrics::get ().write_dropped (request.size);
+
+            int error = request.error;
+            size_t size = request.size;
+            bool finished = request.kind == Request::FINISH;
+            free_request (&request);
+
+            // fail () already took whatever was out off pending, and
+            // later errors have nobody left to hear them
+            if (failed)
+                return;
+
+            pending -= size;
+            if (error) {
+                fail ();
+                signal_error.emit (errno_error (error));
+            }
+
+            check_drained ();
+
+            if (finished && !error)
+                signal_finished.emit ();
+        }
+
+        // still something the destructor has to wait for
+        bool busy () const
+        {
+            return opening || in_flight > 0 ||
+                (fd >= 0 && !failed && !queue.empty ());
+        }
 
         std::string                         dirname;
         std::string                         filename;
-        std::queue<Item>                    queue;
-        Glib::RefPtr<Gio::FileOutputStream> handle;
-        Glib::RefPtr<Glib::MainLoop>        loop;
+        Mode                                mode;
+
+        // written by the open job, read once its done slot runs. after
+        // that, direct, writeback and decoder belong to the DiskWriter
+        // thread while requests are in flight
+        int                                 fd;
+        int                                 direct_fd;
+        std::unique_ptr<DirectWriter>  direct;
+        std::unique_ptr<Writeback>     writeback;
+        std::unique_ptr<Decoder>       decoder;
+        bool                                written;
+        int                                 error;
+
+        bool                                opening;
+        bool                                failed;
+
+        // waiting for the file to open
+        std::queue<Request *>               queue;
+        size_t                              in_flight;
+
+        // streaming to a descriptor we didn't open
+        bool                                stream;
+        size_t                              cursor;
+        size_t                              window;
+        std::map<size_t, Request *>         reorder;
+        size_t                              reordered;
+
         sigc::signal<void, Gio::Error>      signal_error;
+        sigc::signal<void>                  signal_drained;
+        sigc::signal<void>                  signal_finished;
+        size_t                              pending;
+        size_t                              max_pending;
+        bool                                congested;
     };
 
-    IOQueue::IOQueue (const std::string &dirname,
-                      const std::string &filename) :
-        _priv (new Private (dirname, filename))
+    const size_t IOQueue::default_max_pending;
+    const size_t IOQueue::default_window;
+
+    IOQueue::Mode IOQueue::default_mode ()
     {
-        // delay creation of file if filename is empty
-        if (filename.empty ())
-            return;
+        return mode_for_new_queues;
+    }
+
+    void IOQueue::default_mode (Mode mode)
+    {
+        mode_for_new_queues = mode;
+    }
 
-        Glib::RefPtr<Gio::File> gfile =
-            Gio::File::create_for_path (Glib::build_filename (dirname,
-                                                              filename));
+    IOQueue::IOQueue (const std::string &dirname,
+                      const std::string &filename,
+                      Mode mode) :
+        _priv (new Private (dirname, filename, mode))
+    {
+        // delay opening the file if filename is empty
+        if (!filename.empty ())
+            open ();
+    }
 
-        // create file asynchronously and pass this gfile over for
-        // gfile->create_file_finish
-        gfile->create_file_async
-            (sigc::bind<0> (sigc::mem_fun (*this,
-                                           &IOQueue::create_file_finish),
-                            gfile), Gio::FILE_CREATE_REPLACE_DESTINATION);
+    IOQueue::IOQueue (int fd) :
+        _priv (new Private ("", "", BUFFERED))
+    {
+        _priv->fd = fd;
+        _priv->stream = true;
     }
 
     IOQueue::~IOQueue ()
     {
         // we must finish all writes first. run the event loop until done
-        if (_priv->handle && !_priv->queue.empty ())
-            _priv->loop->run ();
+        flush ();
+        Glib::RefPtr<Glib::MainContext> context =
+            Glib::MainContext::get_default ();
+        while (_priv->busy ())
+            context->iteration (true);
+
+        // whatever is left never made it to disk, but still needs freeing
+        _priv->drop_held ();
+
+        // not ours to close
+        if (_priv->stream)
+            return;
+
+        if (_priv->direct_fd >= 0)
+            WorkerPool::get ().push (sigc::bind (sigc::ptr_fun (&close_file),
+                                                 _priv->direct_fd));
+        if (_priv->fd >= 0)
+            WorkerPool::get ().push (sigc::bind (sigc::ptr_fun (&close_file),
+                                                 _priv->fd));
     }
 
     void IOQueue::write (size_t offset, void *data, size_t size)
     {
-        // perform isn't in action, so we need to start the chain
-        bool need_perform = _priv->queue.empty () && _priv->handle;
-        _priv->queue.push (Private::Item (offset, data, size));
-        if (need_perform)
-            perform ();
+        if (size == 0)
+            return;
+
+        // nowhere for it to go, and never counted as queued
+        if (_priv->failed)
+            return;
+
+        _priv->written = true;
+
+        // streaming only queues what isn't already out
+        if (_priv->stream)
+            _priv->stream_write (offset, data, size);
+        else {
+            Metrics::get ().write_queued (size);
+            _priv->queue.push (_priv->make_request
+                               (Private::Request::WRITE, offset, data, size));
+            _priv->pending += size;
+        }
+
+        if (_priv->pending >= _priv->max_pending)
+            _priv->congested = true;
+
+        perform ();
+    }
+
+    bool IOQueue::copy (size_t offset, int fd, size_t size)
+    {
+        // the kernel can't decompress for us
+        if (_priv->stream || _priv->decoder)
+            return false;
+
+        if (size == 0)
+            return true;
+
+        // nowhere for it to go, and never counted as queued
+        if (_priv->failed)
+            return true;
+
+        // our own descriptor, since the caller's may go before we do
+        int source = dup (fd);
+        if (source < 0) {
+            int error = errno;
+            _priv->fail ();
+            _priv->signal_error.emit (errno_error (error));
+            return true;
+        }
+
+        Private::Request *request =
+            _priv->make_request (Private::Request::COPY, offset, NULL, 0);
+        request->size = size;
+        request->source = source;
+
+        _priv->queue.push (request);
+        _priv->pending += size;
+        Metrics::get ().write_queued (size);
+        _priv->written = true;
+
+        if (_priv->pending >= _priv->max_pending)
+            _priv->congested = true;
+
+        perform ();
+        return true;
+    }
+
+    bool IOQueue::decode (const std::string &encoding)
+    {
+        if (_priv->written || _priv->decoder)
+            return false;
+
+        _priv->decoder = Decoder::create (encoding);
+        return _priv->decoder != NULL;
     }
 
     void IOQueue::perform ()
     {
-        // if it's empty, no point doing anything
-        if (_priv->queue.empty ()) {
-            if (_priv->loop->is_running ())
-                _priv->loop->quit ();
+        // nothing happens before the file is open; open_finish calls
+        // us again
+        _priv->submit ();
+    }
+
+    void IOQueue::flush ()
+    {
+        // nothing is held back in buffered mode. the mode only tells us
+        // before the file is open
+        if (_priv->failed || _priv->mode == BUFFERED ||
+            (_priv->fd >= 0 && !_priv->direct && !_priv->writeback))
             return;
-        }
 
-        // grab the first item and perform async work
-        Private::Item &item = _priv->queue.front ();
-        _priv->handle->seek (item.offset, Glib::SEEK_TYPE_SET);
-        _priv->handle
-            ->write_async (item.data, item.size,
-                           sigc::mem_fun (*this, &IOQueue::perform_finish));
+        _priv->queue.push (_priv->make_request
+                           (Private::Request::FLUSH, 0, NULL, 0));
+        perform ();
+    }
 
-        /* when it's done, perform_finish will be called, which will call
-         * perform again.
-         * don't delete item (queue must be non-empty to show perform going
-         * on)
-         */
+    void IOQueue::finish ()
+    {
+        // whoever is listening has heard about it already
+        if (_priv->failed)
+            return;
+
+        Private::Request *request =
+            _priv->make_request (Private::Request::FINISH, 0, NULL, 0);
+        request->append = _priv->stream;
+        _priv->queue.push (request);
+        perform ();
     }
 
     void IOQueue::filename (const std::string &filename)
     {
+        if (_priv->stream || !_priv->filename.empty () || filename.empty ())
+            return;
+
         _priv->filename = filename;
+        open ();
+    }
+
+    std::string IOQueue::filename () const
+    {
+        return _priv->filename;
+    }
+
+    bool IOQueue::is_open () const
+    {
+        return _priv->fd >= 0;
+    }
+
+    bool IOQueue::streaming () const
+    {
+        return _priv->stream;
+    }
+
+    size_t IOQueue::cursor () const
+    {
+        return _priv->cursor;
+    }
+
+    size_t IOQueue::window () const
+    {
+        return _priv->window;
+    }
+
+    void IOQueue::window (size_t bytes)
+    {
+        _priv->window = bytes;
+    }
+
+    size_t IOQueue::reordered () const
+    {
+        return _priv->reordered;
+    }
+
+    size_t IOQueue::pending () const
+    {
+        return _priv->pending;
+    }
+
+    size_t IOQueue::max_pending () const
+    {
+        return _priv->max_pending;
+    }
+
+    void IOQueue::max_pending (size_t bytes)
+    {
+        _priv->max_pending = bytes;
+    }
+
+    bool IOQueue::congested () const
+    {
+        return _priv->congested;
     }
 
     sigc::connection
@@ -128,34 +576,48 @@ namespace Yatta
         return _priv->signal_error.connect (slot);
     }
 
-    void
-    IOQueue::create_file_finish (Glib::RefPtr<Gio::File> file,
-                                 Glib::RefPtr<Gio::AsyncResult> &result)
+    sigc::connection
+    IOQueue::connect_signal_drained (sigc::slot<void> slot)
     {
-        try {
-            _priv->handle = file->create_file_finish (result);
-        } catch (Gio::Error &e) {
-            _priv->signal_error.emit (e);
-        }
+        return _priv->signal_drained.connect (slot);
+    }
 
-        // if perform was waiting, then start the chain
-        if (!_priv->queue.empty ())
-            perform ();
+    sigc::connection
+    IOQueue::connect_signal_finished (sigc::slot<void> slot)
+    {
+        return _priv->signal_finished.connect (slot);
     }
 
-    void IOQueue::perform_finish (Glib::RefPtr<Gio::AsyncResult> &result)
+    void IOQueue::open ()
     {
-        // we're handling this item now. delete it from queue
-        operator delete (_priv->queue.front ().data);
-        _priv->queue.pop ();
+        _priv->opening = true;
+        WorkerPool::get ().push
+            (sigc::bind (sigc::ptr_fun (&open_file), _priv->dirname,
+                         Glib::build_filename (_priv->dirname,
+                                               _priv->filename),
+                         _priv->mode == DIRECT, &_priv->fd,
+                         &_priv->direct_fd, &_priv->error),
+             sigc::mem_fun (*this, &IOQueue::open_finish));
+    }
 
-        // grab result (and check for error), then start the next operation
-        try {
-            _priv->handle->write_finish (result);
+    void IOQueue::open_finish ()
+    {
+        _priv->opening = false;
+
+        if (_priv->direct_fd >= 0)
+            _priv->direct.reset (new DirectWriter (_priv->direct_fd,
+                                                   _priv->fd));
+        else if (_priv->fd >= 0 && _priv->mode == WRITEBACK)
+            _priv->writeback.reset (new Writeback (_priv->fd));
+
+        if (_priv->fd < 0) {
+            _priv->fail ();
+            _priv->signal_error.emit (errno_error (_priv->error));
+        } else
+            // if perform was waiting, then start the chain
             perform ();
-        } catch (Gio::Error &e)
-        {
-            _priv->signal_error.emit (e);
-        }
+
+        // producers held off waiting for the file to open
+        _priv->check_drained ();
     }
 }
@@ -18,7 +18,7 @@
 #ifndef YATTA_CURL_IOQUEUE_H
 #define YATTA_CURL_IOQUEUE_H
 
-#include <tr1/memory>
+#include <memory>
 #include <string>
 
 #include <sigc++/slot.h>
@@ -28,28 +28,119 @@
 
 namespace Yatta
 {
+    /**
+     * @brief: Writes chunk data out to a file, in order of arrival
+     *
+     * Opening the file (creating its directory first) happens on the
+     * WorkerPool, and the writes are handed to the DiskWriter thread,
+     * which does them in order. Data handed to write () is copied, so
+     * the caller's buffer can go right away. If no filename was given,
+     * nothing is opened until filename () is called, and writes wait in
+     * memory until then.
+     *
+     * In DIRECT mode the data goes through a DirectWriter, keeping it
+     * out of the page cache. Filesystems without O_DIRECT support get
+     * BUFFERED instead. WRITEBACK writes through the page cache, but has
+     * a Writeback push finished regions to disk and drop them as it
+     * goes.
+     *
+     * Given a descriptor instead of a file, the data is streamed out
+     * in offset order, for pipes and the like. Anything that arrives
+     * ahead of cursor () is held in a reorder buffer until the gap
+     * before it is filled. The buffer is only bounded by the writer
+     * keeping within window () bytes of the cursor.
+     *
+     * Once told the data is compressed, through decode (), the
+     * DiskWriter decompresses it on its way out. Offsets, pending ()
+     * and the rest still count the compressed bytes.
+     */
     class IOQueue
     {
     public:
+        enum Mode
+        {
+            BUFFERED,
+            DIRECT,
+            WRITEBACK
+        };
+
+        // what new IOQueues use unless told otherwise
+        static Mode default_mode ();
+        static void default_mode (Mode mode);
+
         IOQueue (const std::string &dirname,
-                 const std::string &filename = "");
+                 const std::string &filename = "",
+                 Mode mode = default_mode ());
+
+        // stream to fd, which is left open
+        explicit IOQueue (int fd);
         virtual ~IOQueue ();
 
         void write (size_t offset, void *data, size_t size);
+
+        // size bytes at offset in fd, to the same offset here, copied
+        // in the kernel where possible. fd may be closed right away.
+        // returns false when streaming, where this doesn't work
+        bool copy (size_t offset, int fd, size_t size);
         void perform ();
+
+        // what's written from here on is encoding, and comes in order
+        // from offset 0. returns false if that's not an encoding we can
+        // decode, or data has already been written
+        bool decode (const std::string &encoding);
+
+        // once the writes queued so far are done, write out whatever is
+        // still staged for alignment, or still cached for writeback. the
+        // destructor does this too
+        void flush ();
+
+        // that's all the data: flush, and once everything is out, fire
+        // signal_finished. if it was compressed and turns out to have
+        // been cut short, signal_error fires instead
+        void finish ();
+
+        // opens the file if it hasn't been already. later calls, and
+        // calls while streaming, have no effect
         void filename (const std::string &filename);
+        std::string filename () const;
+
+        bool is_open () const;
+
+        // streaming only: where the next byte out is from, how far
+        // ahead of it writes should stay, and how much is held back
+        // waiting for the gap
+        static const size_t default_window = 32 * 1024 * 1024;
+
+        bool streaming () const;
+        size_t cursor () const;
+        size_t window () const;
+        void window (size_t bytes);
+        size_t reordered () const;
+
+        // back-pressure: once pending () reaches max_pending (), the
+        // producer should hold off until signal_drained fires. when
+        // streaming, data in the reorder buffer doesn't count
+        static const size_t default_max_pending = 16 * 1024 * 1024;
+
+        size_t pending () const;
+        size_t max_pending () const;
+        void max_pending (size_t bytes);
+        bool congested () const;
 
         sigc::connection
         connect_signal_error (sigc::slot<void, Gio::Error> slot);
+        sigc::connection
+        connect_signal_drained (sigc::slot<void> slot);
+        sigc::connection
+        connect_signal_finished (sigc::slot<void> slot);
 
     protected:
-        void create_file_finish (Glib::RefPtr<Gio::File> gfile,
-                                 Glib::RefPtr<Gio::AsyncResult> &result);
-        void perform_finish (Glib::RefPtr<Gio::AsyncResult> &result);
+        void open ();
+        void open_finish ();
 
     private:
         struct Private;
-        std::tr1::shared_ptr<Private> _priv;
+        std::unique_ptr<Private> _priv;
     };
 }
 #endif // YATTA_CURL_IOQUEUE_H
@@ -0,0 +1,550 @@
+/* metrics.cc -- runtime counters for transfer internals
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <sigc++/bind.h>
+#include <glibmm/main.h>
+
+#include "metrics.hh"
+#include "hostinfo.hh"
+#include "unixsocket.hh"
+
+using Yatta::Metrics;
+
+namespace
+{
+    std::string escape (const std::string &value)
+    {
+        std::string result;
+        for (std::string::const_iterator i = value.begin ();
+             i != value.end (); ++i) {
+            if (*i == '\\' || *i == '"')
+                result += '\\';
+
+            if (*i == '\n')
+                result += "\\n";
+            else
+                result += *i;
+        }
+
+        return result;
+    }
+}
+
+struct Metrics::Private
+{
+    struct Download
+    {
+        Download (const std::string &url) :
+            url (url), bytes (0), last_bytes (0), rate (0), chunks (0) {}
+
+        std::string url;
+        size_t      bytes;
+        size_t      last_bytes;
+        double      rate;
+        unsigned    chunks;
+    };
+
+    // a reply still going out to a slow reader
+    struct Client
+    {
+        std::string      reply;
+        size_t           sent;
+        sigc::connection watch;
+    };
+
+    typedef std::map<Id, Download> download_map_t;
+    typedef std::map<std::string, unsigned> host_map_t;
+    typedef std::map<int, Client> client_map_t;
+
+    Private () :
+        next_id (1),
+        bytes (0),
+        last_bytes (0),
+        rate (0),
+        last_tick (g_get_monotonic_time ()),
+        handles (0),
+        queue_depth (0),
+        bytes_pending (0),
+        write_count (0),
+        write_latency_sum (0),
+        chunk_splits (0),
+        chunk_merges (0),
+        chunk_restarts (0),
+        chunk_pauses (0),
+        chunk_reconnects (0),
+        startup_seconds (0),
+        listen_fd (-1),
+        clients (),
+        self (NULL)
+    {
+        std::fill (write_latency, write_latency + latency_buckets + 1, 0);
+    }
+
+    download_map_t downloads;
+    Id             next_id;
+
+    size_t         bytes;
+    size_t         last_bytes;
+    double         rate;
+    gint64         last_tick;
+
+    host_map_t     hosts;
+    unsigned       handles;
+
+    size_t         queue_depth;
+    size_t         bytes_pending;
+
+    unsigned long  write_latency[latency_buckets + 1];
+    unsigned long  write_count;
+    double         write_latency_sum;
+
+    unsigned long  chunk_splits;
+    unsigned long  chunk_merges;
+    unsigned long  chunk_restarts;
+    unsigned long  chunk_pauses;
+    unsigned long  chunk_reconnects;
+
+    double         startup_seconds;
+
+    int              listen_fd;
+    std::string      socket_path;
+    sigc::connection incoming_connection;
+    sigc::connection tick_connection;
+    client_map_t     clients;
+
+    Metrics *self;
+
+    // recompute rates once a second
+    bool on_tick ()
+    {
+        gint64 now = g_get_monotonic_time ();
+        double elapsed = (now - last_tick) / 1e6;
+        last_tick = now;
+
+        if (elapsed <= 0)
+            return true;
+
+        rate = (bytes - last_bytes) / elapsed;
+        last_bytes = bytes;
+
+        for (download_map_t::iterator i = downloads.begin ();
+             i != downloads.end (); ++i) {
+            i->second.rate = (i->second.bytes - i->second.last_bytes) /
+                elapsed;
+            i->second.last_bytes = i->second.bytes;
+        }
+
+        return true;
+    }
+
+    bool on_incoming (Glib::IOCondition)
+    {
+        int fd = accept (listen_fd, NULL, NULL);
+        if (fd < 0)
+            return true;
+
+        // whatever the request was, the answer is the same
+        char request[1024];
+        recv (fd, request, sizeof (request), MSG_DONTWAIT);
+
+        std::string body = self->prometheus ();
+        std::ostringstream reply;
+        reply << "HTTP/1.0 200 OK\r\n"
+              << "Content-Type: text/plain; version=0.0.4\r\n"
+              << "Content-Length: " << body.size () << "\r\n\r\n"
+              << body;
+
+        // we're on the main loop, so a client that doesn't read mustn't
+        // block us. whatever doesn't fit goes out as it makes room
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+        Client &client = clients[fd];
+        client.reply = reply.str ();
+        client.sent = 0;
+        if (send_reply (fd))
+            client.watch = Glib::signal_io ().connect
+                (sigc::bind (sigc::mem_fun (*this, &Private::on_writable),
+                             fd),
+                 fd, Glib::IO_OUT | Glib::IO_HUP | Glib::IO_ERR);
+
+        return true;
+    }
+
+    bool on_writable (Glib::IOCondition, int fd)
+    {
+        return send_reply (fd);
+    }
+
+    // send what we can. returns false once the client is done with,
+    // one way or another
+    bool send_reply (int fd)
+    {
+        Client &client = clients[fd];
+
+        while (client.sent < client.reply.size ()) {
+            ssize_t n = send (fd, client.reply.data () + client.sent,
+                              client.reply.size () - client.sent,
+                              MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            if (n <= 0)
+                break;
+            client.sent += n;
+        }
+
+        clients.erase (fd);
+        close (fd);
+        return false;
+    }
+
+    void close_clients ()
+    {
+        for (client_map_t::iterator i = clients.begin ();
+             i != clients.end (); ++i) {
+            i->second.watch.disconnect ();
+            close (i->first);
+        }
+        clients.clear ();
+    }
+};
+
+Metrics::Metrics () :
+    _priv (new Private)
+{
+    _priv->self = this;
+    _priv->tick_connection = Glib::signal_timeout ().connect_seconds
+        (sigc::mem_fun (*_priv, &Private::on_tick), 1);
+}
+
+Metrics::~Metrics ()
+{
+    _priv->tick_connection.disconnect ();
+    _priv->incoming_connection.disconnect ();
+    _priv->close_clients ();
+
+    if (_priv->listen_fd >= 0) {
+        close (_priv->listen_fd);
+        unlink (_priv->socket_path.c_str ());
+    }
+}
+
+Metrics &Metrics::get ()
+{
+    static Metrics instance;
+    return instance;
+}
+
+double Metrics::latency_bound (unsigned bucket)
+{
+    double bound = 1e-5;
+    for (unsigned i = 0; i < bucket; ++i)
+        bound *= 4;
+    return bound;
+}
+
+Metrics::Snapshot Metrics::snapshot () const
+{
+    Snapshot s;
+
+    s.bytes = _priv->bytes;
+    s.rate = _priv->rate;
+    s.active_handles = _priv->handles;
+    s.host_connections = _priv->hosts;
+    s.queue_depth = _priv->queue_depth;
+    s.bytes_pending = _priv->bytes_pending;
+
+    std::copy (_priv->write_latency,
+               _priv->write_latency + latency_buckets + 1,
+               s.write_latency);
+    s.write_count = _priv->write_count;
+    s.write_latency_sum = _priv->write_latency_sum;
+
+    s.chunk_splits = _priv->chunk_splits;
+    s.chunk_merges = _priv->chunk_merges;
+    s.chunk_restarts = _priv->chunk_restarts;
+    s.chunk_pauses = _priv->chunk_pauses;
+    s.chunk_reconnects = _priv->chunk_reconnects;
+
+    s.startup_seconds = _priv->startup_seconds;
+
+    for (Private::download_map_t::const_iterator i =
+             _priv->downloads.begin ();
+         i != _priv->downloads.end (); ++i) {
+        DownloadStats stats;
+        stats.id = i->first;
+        stats.url = i->second.url;
+        stats.bytes = i->second.bytes;
+        stats.rate = i->second.rate;
+        stats.chunks = i->second.chunks;
+        s.downloads.push_back (stats);
+    }
+
+    return s;
+}
+
+std::string Metrics::prometheus () const
+{
+    Snapshot s = snapshot ();
+    std::ostringstream out;
+
+    out << "# HELP yatta_bytes_total Bytes received by all downloads.\n"
+        << "# TYPE yatta_bytes_total counter\n"
+        << "yatta_bytes_total " << s.bytes << "\n"
+        << "# HELP yatta_bytes_per_second Receive rate of all downloads.\n"
+        << "# TYPE yatta_bytes_per_second gauge\n"
+        << "yatta_bytes_per_second " << s.rate << "\n";
+
+    out << "# HELP yatta_download_bytes_total Bytes received per download.\n"
+        << "# TYPE yatta_download_bytes_total counter\n";
+    for (size_t i = 0; i < s.downloads.size (); ++i)
+        out << "yatta_download_bytes_total{id=\"" << s.downloads[i].id
+            << "\",url=\"" << escape (s.downloads[i].url) << "\"} "
+            << s.downloads[i].bytes << "\n";
+
+    out << "# HELP yatta_download_bytes_per_second Receive rate per "
+        << "download.\n"
+        << "# TYPE yatta_download_bytes_per_second gauge\n";
+    for (size_t i = 0; i < s.downloads.size (); ++i)
+        out << "yatta_download_bytes_per_second{id=\"" << s.downloads[i].id
+            << "\",url=\"" << escape (s.downloads[i].url) << "\"} "
+            << s.downloads[i].rate << "\n";
+
+    out << "# HELP yatta_download_running_chunks Running chunks per "
+        << "download.\n"
+        << "# TYPE yatta_download_running_chunks gauge\n";
+    for (size_t i = 0; i < s.downloads.size (); ++i)
+        out << "yatta_download_running_chunks{id=\"" << s.downloads[i].id
+            << "\",url=\"" << escape (s.downloads[i].url) << "\"} "
+            << s.downloads[i].chunks << "\n";
+
+    out << "# HELP yatta_curl_active_handles Easy handles in the curl "
+        << "multi handle.\n"
+        << "# TYPE yatta_curl_active_handles gauge\n"
+        << "yatta_curl_active_handles " << s.active_handles << "\n"
+        << "# HELP yatta_host_connections Active handles per host.\n"
+        << "# TYPE yatta_host_connections gauge\n";
+    for (std::map<std::string, unsigned>::const_iterator i =
+             s.host_connections.begin ();
+         i != s.host_connections.end (); ++i)
+        out << "yatta_host_connections{host=\"" << escape (i->first)
+            << "\"} " << i->second << "\n";
+
+    out << "# HELP yatta_ioqueue_depth Writes waiting to hit the disk.\n"
+        << "# TYPE yatta_ioqueue_depth gauge\n"
+        << "yatta_ioqueue_depth " << s.queue_depth << "\n"
+        << "# HELP yatta_ioqueue_pending_bytes Bytes waiting to hit the "
+        << "disk.\n"
+        << "# TYPE yatta_ioqueue_pending_bytes gauge\n"
+        << "yatta_ioqueue_pending_bytes " << s.bytes_pending << "\n";
+
+    out << "# HELP yatta_write_latency_seconds Time taken by each disk "
+        << "write.\n"
+        << "# TYPE yatta_write_latency_seconds histogram\n";
+    unsigned long cumulative = 0;
+    for (unsigned i = 0; i < latency_buckets; ++i) {
+        cumulative += s.write_latency[i];
+        out << "yatta_write_latency_seconds_bucket{le=\""
+            << latency_bound (i) << "\"} " << cumulative << "\n";
+    }
+    out << "yatta_write_latency_seconds_bucket{le=\"+Inf\"} "
+        << s.write_count << "\n"
+        << "yatta_write_latency_seconds_sum " << s.write_latency_sum << "\n"
+        << "yatta_write_latency_seconds_count " << s.write_count << "\n";
+
+    out << "# HELP yatta_chunk_splits_total Chunks created by splitting.\n"
+        << "# TYPE yatta_chunk_splits_total counter\n"
+        << "yatta_chunk_splits_total " << s.chunk_splits << "\n"
+        << "# HELP yatta_chunk_merges_total Finished chunks merged into "
+        << "their successor.\n"
+        << "# TYPE yatta_chunk_merges_total counter\n"
+        << "yatta_chunk_merges_total " << s.chunk_merges << "\n"
+        << "# HELP yatta_chunk_restarts_total Chunks restarted after "
+        << "ending early.\n"
+        << "# TYPE yatta_chunk_restarts_total counter\n"
+        << "yatta_chunk_restarts_total " << s.chunk_restarts << "\n"
+        << "# HELP yatta_chunk_pauses_total Chunks paused because the disk "
+        << "fell behind.\n"
+        << "# TYPE yatta_chunk_pauses_total counter\n"
+        << "yatta_chunk_pauses_total " << s.chunk_pauses << "\n"
+        << "# HELP yatta_chunk_reconnects_total Stalled chunks dropped and "
+        << "reconnected.\n"
+        << "# TYPE yatta_chunk_reconnects_total counter\n"
+        << "yatta_chunk_reconnects_total " << s.chunk_reconnects << "\n"
+        << "# HELP yatta_startup_seconds Time from starting up to the main "
+        << "window showing.\n"
+        << "# TYPE yatta_startup_seconds gauge\n"
+        << "yatta_startup_seconds " << s.startup_seconds << "\n";
+
+    return out.str ();
+}
+
+void Metrics::serve (const std::string &path)
+{
+    struct sockaddr_un addr;
+    if (path.size () >= sizeof (addr.sun_path)) {
+        g_warning ("Metrics socket path too long: %s", path.c_str ());
+        return;
+    }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        g_warning ("Could not create metrics socket: %s",
+                   g_strerror (errno));
+        return;
+    }
+
+    std::memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy (addr.sun_path, path.c_str ());
+
+    // a socket left over from a run that crashed would make bind fail.
+    // anything else there, or a socket someone still answers on, is
+    // not ours to remove
+    int error = bind (fd, reinterpret_cast<sockaddr *> (&addr),
+                      sizeof (addr));
+    if (error < 0 && errno == EADDRINUSE && UnixSocket::stale (path)) {
+        unlink (path.c_str ());
+        error = bind (fd, reinterpret_cast<sockaddr *> (&addr),
+                      sizeof (addr));
+    }
+
+    if (error < 0 || listen (fd, 8) < 0) {
+        g_warning ("Could not listen on %s: %s", path.c_str (),
+                   g_strerror (errno));
+        close (fd);
+        return;
+    }
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+    _priv->listen_fd = fd;
+    _priv->socket_path = path;
+    _priv->incoming_connection = Glib::signal_io ().connect
+        (sigc::mem_fun (*_priv, &Private::on_incoming), fd, Glib::IO_IN);
+}
+
+Metrics::Id Metrics::add_download (const std::string &url)
+{
+    Id id = _priv->next_id++;
+    _priv->downloads.insert (std::make_pair (id, Private::Download (url)));
+    return id;
+}
+
+void Metrics::remove_download (Id id)
+{
+    _priv->downloads.erase (id);
+}
+
+void Metrics::download_bytes (Id id, size_t bytes)
+{
+    _priv->bytes += bytes;
+
+    Private::download_map_t::iterator i = _priv->downloads.find (id);
+    if (i != _priv->downloads.end ())
+        i->second.bytes += bytes;
+}
+
+void Metrics::download_chunks (Id id, unsigned running)
+{
+    Private::download_map_t::iterator i = _priv->downloads.find (id);
+    if (i != _priv->downloads.end ())
+        i->second.chunks = running;
+}
+
+void Metrics::chunks_split (unsigned count)
+{
+    _priv->chunk_splits += count;
+}
+
+void Metrics::chunk_merged ()
+{
+    _priv->chunk_merges++;
+}
+
+void Metrics::chunk_restarted ()
+{
+    _priv->chunk_restarts++;
+}
+
+void Metrics::chunk_paused ()
+{
+    _priv->chunk_pauses++;
+}
+
+void Metrics::chunk_reconnected ()
+{
+    _priv->chunk_reconnects++;
+}
+
+void Metrics::handle_added (const std::string &url)
+{
+    _priv->handles++;
+    _priv->hosts[HostInfo::origin (url)]++;
+}
+
+void Metrics::handle_removed (const std::string &url)
+{
+    _priv->handles--;
+
+    Private::host_map_t::iterator i = _priv->hosts.find (HostInfo::origin (url));
+    if (i != _priv->hosts.end () && --i->second == 0)
+        _priv->hosts.erase (i);
+}
+
+void Metrics::write_queued (size_t bytes)
+{
+    _priv->queue_depth++;
+    _priv->bytes_pending += bytes;
+}
+
+void Metrics::write_dropped (size_t bytes)
+{
+    _priv->queue_depth--;
+    _priv->bytes_pending -= bytes;
+}
+
+void Metrics::write_done (size_t bytes, double seconds)
+{
+    _priv->queue_depth--;
+    _priv->bytes_pending -= bytes;
+
+    unsigned bucket = 0;
+    while (bucket < latency_buckets && seconds > latency_bound (bucket))
+        bucket++;
+
+    _priv->write_latency[bucket]++;
+    _priv->write_count++;
+    _priv->write_latency_sum += seconds;
+}
+
+void Metrics::startup_done (double seconds)
+{
+    _priv->startup_seconds = seconds;
+}
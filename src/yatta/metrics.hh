@@ -0,0 +1,124 @@
+/* metrics.hh -- runtime counters for transfer internals
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_METRICS_H
+#define YATTA_METRICS_H
+
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Yatta
+{
+    /**
+     * @brief: Process-wide counters, updated from the main loop
+     *
+     * Hot paths only bump plain integers; rates are derived once a
+     * second. Read everything at once with snapshot (), or serve () it
+     * in Prometheus text format on a UNIX socket.
+     */
+    class Metrics
+    {
+    public:
+        typedef unsigned long Id;
+
+        // write latency bucket upper bounds are 10us * 4^i
+        static const unsigned latency_buckets = 12;
+        static double latency_bound (unsigned bucket);
+
+        struct DownloadStats
+        {
+            Id          id;
+            std::string url;
+            size_t      bytes;
+            double      rate;   // bytes/s over the last second
+            unsigned    chunks; // running chunks
+        };
+
+        struct Snapshot
+        {
+            size_t bytes;
+            double rate;
+
+            unsigned active_handles;
+            std::map<std::string, unsigned> host_connections;
+
+            size_t queue_depth;
+            size_t bytes_pending;
+
+            // per-bucket counts, the last one being +Inf
+            unsigned long write_latency[latency_buckets + 1];
+            unsigned long write_count;
+            double        write_latency_sum;
+
+            unsigned long chunk_splits;
+            unsigned long chunk_merges;
+            unsigned long chunk_restarts;
+            unsigned long chunk_pauses;
+            unsigned long chunk_reconnects;
+
+            // from exec to the main window first showing, 0 until then
+            double startup_seconds;
+
+            std::vector<DownloadStats> downloads;
+        };
+
+        static Metrics &get ();
+
+        Snapshot snapshot () const;
+        std::string prometheus () const;
+
+        // serve prometheus () to anything connecting to path
+        void serve (const std::string &path);
+
+        // hooks for Download
+        Id add_download (const std::string &url);
+        void remove_download (Id id);
+        void download_bytes (Id id, size_t bytes);
+        void download_chunks (Id id, unsigned running);
+        void chunks_split (unsigned count);
+        void chunk_merged ();
+        void chunk_restarted ();
+        void chunk_paused ();
+        void chunk_reconnected ();
+
+        // hooks for Curl::Manager
+        void handle_added (const std::string &url);
+        void handle_removed (const std::string &url);
+
+        // hooks for IOQueue
+        void write_queued (size_t bytes);
+        void write_done (size_t bytes, double seconds);
+        void write_dropped (size_t bytes);
+
+        // hook for UI::Main
+        void startup_done (double seconds);
+
+        ~Metrics ();
+
+    private:
+        Metrics ();
+        Metrics (const Metrics &) = delete;
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_METRICS_H
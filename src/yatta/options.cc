@@ -28,17 +28,149 @@ namespace Yatta
     struct Options::Priv
     {
         Priv () :
-            maingroup ("main", "Main options") {}
+            maingroup ("main", "Main options"),
+            max_active (0),
+            io_mode ("buffered"),
+            min_speed (0),
+            compressed ("no"),
+            new_instance (false),
+            measure_startup (false) {}
         Glib::OptionGroup maingroup;
+        std::string       metrics_socket;
+        std::string       import_file;
+        int               max_active;
+        Glib::ustring     io_mode;
+        int               min_speed;
+        Glib::ustring     compressed;
+        std::string       output;
+        bool              new_instance;
+        bool              measure_startup;
     };
 
     Options::Options () :
         Glib::OptionContext (),
         _priv (new Priv ())
     {
+        Glib::OptionEntry metrics_socket;
+        metrics_socket.set_long_name ("metrics-socket");
+        metrics_socket.set_description
+            (_("Serve Prometheus metrics on a UNIX socket"));
+        metrics_socket.set_arg_description (_("PATH"));
+        _priv->maingroup.add_entry_filename (metrics_socket,
+                                             _priv->metrics_socket);
+
+        Glib::OptionEntry import_file;
+        import_file.set_long_name ("import");
+        import_file.set_description
+            (_("Queue up the URLs listed in FILE, or stdin if FILE is -"));
+        import_file.set_arg_description (_("FILE"));
+        _priv->maingroup.add_entry_filename (import_file,
+                                             _priv->import_file);
+
+        Glib::OptionEntry max_active;
+        max_active.set_long_name ("max-active");
+        max_active.set_description
+            (_("Number of queued downloads to run at once"));
+        max_active.set_arg_description (_("N"));
+        _priv->maingroup.add_entry (max_active, _priv->max_active);
+
+        Glib::OptionEntry io_mode;
+        io_mode.set_long_name ("io-mode");
+        io_mode.set_description
+            (_("Write files through the page cache (buffered), around it "
+               "(direct), or through it with streaming writeback "
+               "(writeback)"));
+        io_mode.set_arg_description (_("MODE"));
+        _priv->maingroup.add_entry (io_mode, _priv->io_mode);
+
+        Glib::OptionEntry min_speed;
+        min_speed.set_long_name ("min-speed");
+        min_speed.set_description
+            (_("Reconnect chunks that stay slower than this, in bytes per "
+               "second"));
+        min_speed.set_arg_description (_("BYTES"));
+        _priv->maingroup.add_entry (min_speed, _priv->min_speed);
+
+        Glib::OptionEntry compressed;
+        compressed.set_long_name ("compressed");
+        compressed.set_description
+            (_("Ask for files compressed, and save them decompressed "
+               "(decode) or as sent (keep), or don't ask (no)"));
+        compressed.set_arg_description (_("MODE"));
+        _priv->maingroup.add_entry (compressed, _priv->compressed);
+
+        Glib::OptionEntry output;
+        output.set_long_name ("output");
+        output.set_short_name ('o');
+        output.set_description
+            (_("Download the URL given and write it out in order to FILE, "
+               "or stdout if FILE is -, without starting the interface"));
+        output.set_arg_description (_("FILE"));
+        _priv->maingroup.add_entry_filename (output, _priv->output);
+
+        Glib::OptionEntry new_instance;
+        new_instance.set_long_name ("new-instance");
+        new_instance.set_description
+            (_("Start a new window even if Yatta is already running, "
+               "instead of handing the URLs over to it"));
+        _priv->maingroup.add_entry (new_instance, _priv->new_instance);
+
+        Glib::OptionEntry measure_startup;
+        measure_startup.set_long_name ("measure-startup");
+        measure_startup.set_description
+            (_("Print how long it took for the window to show up, then "
+               "quit"));
+        _priv->maingroup.add_entry (measure_startup,
+                                    _priv->measure_startup);
+
         set_main_group (_priv->maingroup);
     }
 
+    std::string Options::metrics_socket () const
+    {
+        return _priv->metrics_socket;
+    }
+
+    std::string Options::import_file () const
+    {
+        return _priv->import_file;
+    }
+
+    unsigned short Options::max_active () const
+    {
+        return _priv->max_active > 0 ? _priv->max_active : 0;
+    }
+
+    std::string Options::io_mode () const
+    {
+        return _priv->io_mode;
+    }
+
+    size_t Options::min_speed () const
+    {
+        return _priv->min_speed > 0 ? _priv->min_speed : 0;
+    }
+
+    std::string Options::compressed () const
+    {
+        return _priv->compressed;
+    }
+
+    std::string Options::output () const
+    {
+        return _priv->output;
+    }
+
+    bool Options::new_instance () const
+    {
+        return _priv->new_instance;
+    }
+
+    bool Options::measure_startup () const
+    {
+        return _priv->measure_startup;
+    }
+
     Options::~Options ()
     {
     }
@@ -18,7 +18,8 @@
 #ifndef YATTA_OPTIONS_H
 #define YATTA_OPTIONS_H
 
-#include <tr1/memory>
+#include <memory>
+#include <string>
 
 #include <glibmm/optioncontext.h>
 
@@ -30,10 +31,39 @@ namespace Yatta
         public:
             Options ();
 
+            // UNIX socket to serve metrics on, empty if disabled
+            std::string metrics_socket () const;
+
+            // URL list to queue up ("-" for stdin), empty if none
+            std::string import_file () const;
+
+            // downloads the queue runs at once, 0 if not given
+            unsigned short max_active () const;
+
+            // how files get written: "buffered", "direct" or "writeback"
+            std::string io_mode () const;
+
+            // bytes/s below which chunks get reconnected, 0 if not given
+            size_t min_speed () const;
+
+            // whether to ask for compressed files: "no", "decode" or
+            // "keep"
+            std::string compressed () const;
+
+            // where to stream a single download to ("-" for stdout)
+            // instead of saving it, empty if not given
+            std::string output () const;
+
+            // whether to run on our own even if another Yatta is up
+            bool new_instance () const;
+
+            // whether to report the time to the first window and quit
+            bool measure_startup () const;
+
             virtual ~Options ();
         private:
             struct Priv;
-            std::tr1::shared_ptr<Priv> _priv;
+            std::unique_ptr<Priv> _priv;
     };
 }
 
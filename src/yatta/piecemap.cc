@@ -0,0 +1,118 @@
+/* piecemap.cc -- which fixed-size pieces of a download are done
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+
+#include "piecemap.hh"
+
+using Yatta::PieceMap;
+
+const size_t PieceMap::default_piece_size;
+
+PieceMap::PieceMap (size_t size, size_t piece_size) :
+    _size (size),
+    _piece_size (piece_size ? piece_size : default_piece_size),
+    _have ((size + _piece_size - 1) / _piece_size, false),
+    _missing (_have.size ()),
+    _done ()
+{
+}
+
+size_t PieceMap::size () const
+{
+    return _size;
+}
+
+size_t PieceMap::piece_size () const
+{
+    return _piece_size;
+}
+
+size_t PieceMap::count () const
+{
+    return _have.size ();
+}
+
+bool PieceMap::have (size_t piece) const
+{
+    return piece < _have.size () && _have[piece];
+}
+
+size_t PieceMap::missing () const
+{
+    return _missing;
+}
+
+bool PieceMap::complete () const
+{
+    return _missing == 0;
+}
+
+size_t PieceMap::align_down (size_t offset) const
+{
+    return offset - offset % _piece_size;
+}
+
+size_t PieceMap::align_up (size_t offset) const
+{
+    return align_down (offset + _piece_size - 1);
+}
+
+void PieceMap::completed (size_t offset, size_t size)
+{
+    if (size == 0 || offset >= _size)
+        return;
+
+    size_t begin = offset;
+    size_t end = std::min (offset + size, _size);
+
+    // swallow every range this touches or overlaps
+    std::map<size_t, size_t>::iterator i = _done.upper_bound (begin);
+    if (i != _done.begin ()) {
+        std::map<size_t, size_t>::iterator previous = i;
+        --previous;
+        if (previous->second >= begin) {
+            begin = previous->first;
+            end = std::max (end, previous->second);
+            _done.erase (previous);
+        }
+    }
+
+    while (i != _done.end () && i->first <= end) {
+        end = std::max (end, i->second);
+        _done.erase (i++);
+    }
+
+    _done[begin] = end;
+
+    // only the pieces around the new bytes can have changed
+    size_t first = std::max (align_up (begin), align_down (offset));
+    size_t last = std::min (end == _size ? _size : align_down (end),
+                            align_up (std::min (offset + size, _size)));
+    if (first < last)
+        mark (first / _piece_size, (last - 1) / _piece_size);
+}
+
+void PieceMap::mark (size_t first, size_t last)
+{
+    for (size_t piece = first; piece <= last; ++piece)
+        if (!_have[piece]) {
+            _have[piece] = true;
+            --_missing;
+        }
+}
@@ -0,0 +1,73 @@
+/* piecemap.hh -- which fixed-size pieces of a download are done
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_PIECEMAP_H
+#define YATTA_PIECEMAP_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace Yatta
+{
+    /**
+     * @brief: A bitmap of the fixed-size pieces of a file
+     *
+     * Chunks report the bytes they've written, in any order and
+     * overlapping if need be (racing chunks in endgame do). A piece
+     * counts once every byte of it has been reported. Chunk boundaries
+     * are kept on piece boundaries, so that a piece is only ever
+     * fetched whole, from one source. Plain C++, no glib.
+     */
+    class PieceMap
+    {
+    public:
+        static const size_t default_piece_size = 1024 * 1024;
+
+        explicit PieceMap (size_t size = 0,
+                           size_t piece_size = default_piece_size);
+
+        size_t size () const;
+        size_t piece_size () const;
+        size_t count () const;
+
+        bool have (size_t piece) const;
+        size_t missing () const;
+        bool complete () const;
+
+        // the piece boundary at or before offset, and at or after it
+        size_t align_down (size_t offset) const;
+        size_t align_up (size_t offset) const;
+
+        // bytes [offset, offset + size) are on disk
+        void completed (size_t offset, size_t size);
+
+    private:
+        void mark (size_t first, size_t last);
+
+        size_t                   _size;
+        size_t                   _piece_size;
+        std::vector<bool>        _have;
+        size_t                   _missing;
+
+        // done byte ranges, merged, by start
+        std::map<size_t, size_t> _done;
+    };
+}
+
+#endif // YATTA_PIECEMAP_H
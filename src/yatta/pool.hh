@@ -0,0 +1,153 @@
+/* pool.hh -- free lists for objects made and dropped all the time
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_POOL_H
+#define YATTA_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace Yatta
+{
+    /**
+     * @brief: Blocks of sizeof (T), kept for reuse once freed
+     *
+     * Up to max_free blocks are held on to, so that something split
+     * and merged over and over, like chunks, stops reaching malloc once
+     * it's warmed up. Not thread safe: main loop only.
+     */
+    template <typename T>
+    class Pool
+    {
+    public:
+        static constexpr size_t max_free = 256;
+
+        static void *allocate ()
+        {
+            std::vector<void *> &blocks = free_list ().blocks;
+            if (blocks.empty ())
+                return ::operator new (sizeof (T));
+
+            void *block = blocks.back ();
+            blocks.pop_back ();
+            return block;
+        }
+
+        static void release (void *block)
+        {
+            std::vector<void *> &blocks = free_list ().blocks;
+            if (blocks.size () >= max_free)
+                ::operator delete (block);
+            else
+                blocks.push_back (block);
+        }
+
+        // how many blocks are waiting to be reused
+        static size_t available ()
+        {
+            return free_list ().blocks.size ();
+        }
+
+    private:
+        struct FreeList
+        {
+            FreeList ()
+            {
+                blocks.reserve (max_free);
+            }
+
+            ~FreeList ()
+            {
+                for (size_t i = 0; i < blocks.size (); ++i)
+                    ::operator delete (blocks[i]);
+            }
+
+            std::vector<void *> blocks;
+        };
+
+        static FreeList &free_list ()
+        {
+            static FreeList instance;
+            return instance;
+        }
+    };
+
+    // for std::allocate_shared and containers: single objects come out
+    // of the Pool, arrays go straight to operator new
+    template <typename T>
+    struct PoolAllocator
+    {
+        typedef T value_type;
+
+        PoolAllocator () {}
+        template <typename U>
+        PoolAllocator (const PoolAllocator<U> &) {}
+
+        T *allocate (size_t n)
+        {
+            if (n == 1)
+                return static_cast<T *> (Pool<T>::allocate ());
+            return static_cast<T *> (::operator new (n * sizeof (T)));
+        }
+
+        void deallocate (T *block, size_t n)
+        {
+            if (n == 1)
+                Pool<T>::release (block);
+            else
+                ::operator delete (block);
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator== (const PoolAllocator<T> &, const PoolAllocator<U> &)
+    {
+        return true;
+    }
+
+    template <typename T, typename U>
+    bool operator!= (const PoolAllocator<T> &, const PoolAllocator<U> &)
+    {
+        return false;
+    }
+
+    // derive from Pooled<T> to have new T come out of the Pool. anything
+    // derived from T is bigger, and gets plain operator new
+    template <typename T>
+    class Pooled
+    {
+    public:
+        static void *operator new (size_t size)
+        {
+            if (size != sizeof (T))
+                return ::operator new (size);
+            return Pool<T>::allocate ();
+        }
+
+        static void operator delete (void *block, size_t size)
+        {
+            if (size != sizeof (T))
+                ::operator delete (block);
+            else
+                Pool<T>::release (block);
+        }
+    };
+}
+
+#endif // YATTA_POOL_H
@@ -0,0 +1,472 @@
+/* queue.cc -- holds many downloads, running a few of them at a time
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <sigc++/bind.h>
+#include <sigc++/signal.h>
+#include <glibmm/main.h>
+
+#include "queue.hh"
+#include "download.hh"
+
+using Yatta::Queue;
+
+namespace
+{
+    std::string trim (const std::string &line)
+    {
+        const char *space = " \t\r\n";
+        size_t start = line.find_first_not_of (space);
+        if (start == std::string::npos)
+            return std::string ();
+
+        return line.substr (start, line.find_last_not_of (space) - start + 1);
+    }
+}
+
+struct Queue::Private
+{
+    // kept small: there may be tens of thousands of these
+    struct Entry
+    {
+        size_t        url;   // offset into url_pool
+        size_t        dir;   // index into dirs
+        unsigned char state;
+    };
+
+    typedef std::map<Id, Download *> download_map_t;
+    typedef std::map<Curl::Fetch *, Id> fetch_map_t;
+
+    Private () :
+        url_pool (),
+        entries (),
+        dirs (),
+        dir_index (),
+        next (0),
+        active (),
+        reaped (),
+        fetches (),
+        idle_fetches (),
+        max_active (4),
+        small_file_limit (1024 * 1024),
+        running (false)
+    {
+        counts[QUEUED] = counts[ACTIVE] = counts[FINISHED] = counts[FAILED] = 0;
+    }
+
+    ~Private ()
+    {
+        // a download being deleted can still report back and land in
+        // reaped, so take each list before going through it
+        download_map_t running;
+        running.swap (active);
+        for (download_map_t::iterator i = running.begin ();
+             i != running.end (); ++i)
+            delete i->second;
+
+        while (!reaped.empty ())
+            delete_reaped ();
+        reap_connection.disconnect ();
+
+        for (fetch_map_t::iterator i = fetches.begin ();
+             i != fetches.end (); ++i)
+            delete i->first;
+
+        clear_idle_fetches ();
+    }
+
+    void clear_idle_fetches ()
+    {
+        for (std::vector<Curl::Fetch *>::iterator i = idle_fetches.begin ();
+             i != idle_fetches.end (); ++i)
+            delete *i;
+        idle_fetches.clear ();
+    }
+
+    void delete_reaped ()
+    {
+        std::vector<Download *> doomed;
+        doomed.swap (reaped);
+        for (std::vector<Download *>::iterator i = doomed.begin ();
+             i != doomed.end (); ++i)
+            delete *i;
+    }
+
+    size_t active_count () const
+    {
+        return active.size () + fetches.size ();
+    }
+
+    size_t intern_dir (const std::string &dirname)
+    {
+        std::map<std::string, size_t>::iterator i =
+            dir_index.find (dirname);
+        if (i != dir_index.end ())
+            return i->second;
+
+        size_t index = dirs.size ();
+        dirs.push_back (dirname);
+        dir_index[dirname] = index;
+        return index;
+    }
+
+    void set_state (Id id, State state)
+    {
+        counts[entries[id].state]--;
+        counts[state]++;
+        entries[id].state = state;
+    }
+
+    // NUL separated URLs, one allocation for all of them
+    std::string                           url_pool;
+    std::vector<Entry>                    entries;
+    std::vector<std::string>              dirs;
+    std::map<std::string, size_t>         dir_index;
+
+    // no entry before this one is still queued
+    Id                                    next;
+
+    download_map_t                        active;
+
+    // finished downloads, deleted once we're out of their signal handlers
+    std::vector<Download *>               reaped;
+    sigc::connection                      reap_connection;
+
+    // running fetches, and spare ones whose easy handles get reused
+    fetch_map_t                           fetches;
+    std::vector<Curl::Fetch *>            idle_fetches;
+
+    unsigned short                        max_active;
+    size_t                                small_file_limit;
+    bool                                  running;
+    size_t                                counts[4];
+
+    sigc::signal<void, Id>                signal_finished;
+    sigc::signal<void>                    signal_drained;
+};
+
+Queue::Queue () :
+    sigc::trackable (),
+    _priv (new Private)
+{
+}
+
+Queue::~Queue ()
+{
+}
+
+Queue::Id Queue::add (const Glib::ustring &url, const std::string &dirname)
+{
+    Private::Entry entry;
+    entry.url = _priv->url_pool.size ();
+    entry.dir = _priv->intern_dir (dirname);
+    entry.state = QUEUED;
+
+    _priv->url_pool.append (url.raw ());
+    _priv->url_pool.push_back ('\0');
+    _priv->entries.push_back (entry);
+    _priv->counts[QUEUED]++;
+
+    fill ();
+
+    return _priv->entries.size () - 1;
+}
+
+size_t Queue::import (std::istream &in, const std::string &dirname)
+{
+    // don't start anything until the whole list is in
+    bool was_running = _priv->running;
+    _priv->running = false;
+
+    size_t added = 0;
+    std::string line;
+    while (std::getline (in, line)) {
+        line = trim (line);
+        if (line.empty () || line[0] == '#')
+            continue;
+
+        add (line, dirname);
+        added++;
+    }
+
+    _priv->running = was_running;
+    fill ();
+
+    return added;
+}
+
+size_t Queue::import (const std::string &path, const std::string &dirname)
+{
+    if (path == "-")
+        return import (std::cin, dirname);
+
+    std::ifstream in (path.c_str ());
+    if (!in) {
+        g_warning ("Could not open %s for import", path.c_str ());
+        return 0;
+    }
+
+    return import (in, dirname);
+}
+
+void Queue::start ()
+{
+    if (_priv->running)
+        return;
+
+    _priv->running = true;
+    fill ();
+}
+
+void Queue::stop ()
+{
+    if (!_priv->running)
+        return;
+
+    _priv->running = false;
+
+    // put whatever was running back in the queue. it starts over from
+    // scratch next time
+    for (Private::download_map_t::iterator i = _priv->active.begin ();
+         i != _priv->active.end (); ++i) {
+        i->second->stop ();
+        _priv->reaped.push_back (i->second);
+        _priv->set_state (i->first, QUEUED);
+        _priv->next = std::min (_priv->next, i->first);
+    }
+    _priv->active.clear ();
+
+    // a fetch that's already saving its file gets to finish
+    for (Private::fetch_map_t::iterator i = _priv->fetches.begin ();
+         i != _priv->fetches.end ();) {
+        i->first->stop ();
+        if (i->first->running ()) {
+            ++i;
+            continue;
+        }
+
+        _priv->idle_fetches.push_back (i->first);
+        _priv->set_state (i->second, QUEUED);
+        _priv->next = std::min (_priv->next, i->second);
+        _priv->fetches.erase (i++);
+    }
+
+    if (!_priv->reap_connection.connected ())
+        _priv->reap_connection = Glib::signal_idle ().connect
+            (sigc::mem_fun (*this, &Queue::on_reap));
+}
+
+unsigned short Queue::max_active () const
+{
+    return _priv->max_active;
+}
+
+void Queue::max_active (unsigned short max_active)
+{
+    g_assert (max_active > 0);
+
+    // running downloads above the new limit are left to finish
+    _priv->max_active = max_active;
+    fill ();
+}
+
+size_t Queue::small_file_limit () const
+{
+    return _priv->small_file_limit;
+}
+
+void Queue::small_file_limit (size_t limit)
+{
+    // spare fetches were made for the old limit
+    _priv->small_file_limit = limit;
+    _priv->clear_idle_fetches ();
+}
+
+bool Queue::running () const
+{
+    return _priv->running;
+}
+
+Glib::ustring Queue::url (Id id) const
+{
+    return _priv->url_pool.c_str () + _priv->entries[id].url;
+}
+
+std::string Queue::dirname (Id id) const
+{
+    return _priv->dirs[_priv->entries[id].dir];
+}
+
+Queue::State Queue::state (Id id) const
+{
+    return static_cast<State> (_priv->entries[id].state);
+}
+
+size_t Queue::size () const
+{
+    return _priv->entries.size ();
+}
+
+size_t Queue::count (State state) const
+{
+    return _priv->counts[state];
+}
+
+sigc::connection
+Queue::connect_signal_finished (const sigc::slot<void, Id> &slot)
+{
+    return _priv->signal_finished.connect (slot);
+}
+
+sigc::connection
+Queue::connect_signal_drained (const sigc::slot<void> &slot)
+{
+    return _priv->signal_drained.connect (slot);
+}
+
+void Queue::fill ()
+{
+    while (_priv->running &&
+           _priv->active_count () < _priv->max_active &&
+           _priv->next < _priv->entries.size ()) {
+        Id id = _priv->next++;
+        if (state (id) != QUEUED)
+            continue;
+
+        _priv->set_state (id, ACTIVE);
+
+        if (_priv->small_file_limit)
+            start_fetch (id);
+        else
+            start_download (id);
+    }
+}
+
+void Queue::start_fetch (Id id)
+{
+    Curl::Fetch *fetch;
+    if (_priv->idle_fetches.empty ()) {
+        fetch = new Curl::Fetch (_priv->small_file_limit);
+        fetch->connect_signal_finished
+            (sigc::bind (sigc::mem_fun (*this, &Queue::on_fetch_finished),
+                         fetch));
+    } else {
+        fetch = _priv->idle_fetches.back ();
+        _priv->idle_fetches.pop_back ();
+    }
+
+    std::string link = url (id);
+    _priv->fetches[fetch] = id;
+    fetch->start (link, dirname (id));
+}
+
+void Queue::start_download (Id id)
+{
+    std::string link = url (id);
+    Download *download = new Download (link, dirname (id));
+    download->connect_signal_finished
+        (sigc::bind (sigc::mem_fun (*this, &Queue::on_download_finished),
+                     id));
+    download->connect_signal_error
+        (sigc::bind (sigc::mem_fun (*this, &Queue::on_download_failed),
+                     id));
+
+    _priv->active[id] = download;
+    download->start ();
+}
+
+void Queue::finish (Id id, State state)
+{
+    _priv->set_state (id, state);
+    _priv->signal_finished (id);
+
+    fill ();
+
+    if (_priv->active_count () == 0 && _priv->counts[QUEUED] == 0)
+        _priv->signal_drained ();
+}
+
+void Queue::on_fetch_finished (Curl::Fetch::Result result,
+                               Curl::Fetch *fetch)
+{
+    Private::fetch_map_t::iterator i = _priv->fetches.find (fetch);
+    g_assert (i != _priv->fetches.end ());
+
+    Id id = i->second;
+    _priv->fetches.erase (i);
+    _priv->idle_fetches.push_back (fetch);
+
+    switch (result) {
+    case Curl::Fetch::DONE:
+        finish (id, FINISHED);
+        break;
+
+    case Curl::Fetch::TOO_BIG:
+        // it stays active, just with the heavy machinery this time
+        start_download (id);
+        break;
+
+    case Curl::Fetch::FAILED:
+        finish (id, FAILED);
+        break;
+    }
+}
+
+void Queue::on_download_finished (Id id)
+{
+    reap_download (id, FINISHED);
+}
+
+void Queue::on_download_failed (Gio::Error error, Id id)
+{
+    g_warning ("%s: %s", url (id).c_str (), error.what ().c_str ());
+    reap_download (id, FAILED);
+}
+
+void Queue::reap_download (Id id, State state)
+{
+    // an error may follow the one that already ended it
+    Private::download_map_t::iterator i = _priv->active.find (id);
+    if (i == _priv->active.end ())
+        return;
+
+    // we're inside one of its signal handlers, so it has to live a little
+    // longer
+    _priv->reaped.push_back (i->second);
+    _priv->active.erase (i);
+
+    if (!_priv->reap_connection.connected ())
+        _priv->reap_connection = Glib::signal_idle ().connect
+            (sigc::mem_fun (*this, &Queue::on_reap));
+
+    finish (id, state);
+}
+
+bool Queue::on_reap ()
+{
+    _priv->delete_reaped ();
+
+    // ~IOQueue runs the main loop, so deleting one download may have
+    // reaped another. keep going until nothing's left
+    return !_priv->reaped.empty ();
+}
@@ -0,0 +1,123 @@
+/* queue.hh -- holds many downloads, running a few of them at a time
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_QUEUE_H
+#define YATTA_QUEUE_H
+
+#include <memory>
+#include <istream>
+#include <string>
+
+#include <sigc++/trackable.h>
+#include <sigc++/connection.h>
+#include <sigc++/slot.h>
+#include <glibmm/ustring.h>
+#include <giomm/error.h>
+
+#include "curl/fetch.hh"
+
+namespace Yatta
+{
+    /**
+     * @brief: A list of URLs to fetch, at most max_active () at once
+     *
+     * Queued entries are only a URL and a directory. A Download is
+     * created when an entry gets its turn and destroyed once it's done,
+     * so the queue can hold far more entries than could ever run. Files
+     * are named from the response headers or the URL.
+     *
+     * Entries are first tried with a Curl::Fetch, which gets small
+     * files in one request without any of the chunking machinery. Only
+     * those bigger than small_file_limit () get a Download.
+     */
+    class Queue : public sigc::trackable
+    {
+    public:
+        typedef size_t Id;
+
+        enum State
+        {
+            QUEUED,
+            ACTIVE,
+            FINISHED,
+            FAILED
+        };
+
+        Queue ();
+        ~Queue ();
+
+        Id add (const Glib::ustring &url, const std::string &dirname);
+
+        // one URL per line; blank lines and lines starting with # are
+        // skipped. returns the number of entries added
+        size_t import (std::istream &in, const std::string &dirname);
+
+        // as above, reading from stdin if path is "-"
+        size_t import (const std::string &path, const std::string &dirname);
+
+        void start ();
+        void stop ();
+
+        // accessors
+        unsigned short max_active () const;
+        void max_active (unsigned short max_active);
+
+        // largest file fetched in one go, 0 to always use a Download
+        size_t small_file_limit () const;
+        void small_file_limit (size_t limit);
+
+        bool running () const;
+
+        Glib::ustring url (Id id) const;
+        std::string dirname (Id id) const;
+        State state (Id id) const;
+
+        size_t size () const;
+        size_t count (State state) const;
+
+        // signals
+        sigc::connection
+        connect_signal_finished (const sigc::slot<void, Id> &slot);
+        sigc::connection
+        connect_signal_drained (const sigc::slot<void> &slot);
+
+    private:
+        Queue (const Queue &) = delete;
+
+        // start queued entries until max_active () are running
+        void fill ();
+
+        void start_fetch (Id id);
+        void start_download (Id id);
+        void finish (Id id, State state);
+
+        void on_fetch_finished (Curl::Fetch::Result result,
+                                Curl::Fetch *fetch);
+        void on_download_finished (Id id);
+        void on_download_failed (Gio::Error error, Id id);
+
+        // done with the Download for id, once its handlers have returned
+        void reap_download (Id id, State state);
+        bool on_reap ();
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_QUEUE_H
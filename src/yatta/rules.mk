@@ -6,10 +6,51 @@ libyatta_la_SOURCES += \
 	src/yatta/download.cc \
 	src/yatta/download.hh \
 	src/yatta/chunk.cc \
-	src/yatta/chunk.hh
+	src/yatta/chunk.hh \
+	src/yatta/metrics.cc \
+	src/yatta/metrics.hh \
+	src/yatta/trace.cc \
+	src/yatta/trace.hh \
+	src/yatta/hostinfo.cc \
+	src/yatta/hostinfo.hh \
+	src/yatta/queue.cc \
+	src/yatta/queue.hh \
+	src/yatta/workerpool.cc \
+	src/yatta/workerpool.hh \
+	src/yatta/filename.cc \
+	src/yatta/filename.hh \
+	src/yatta/directwriter.cc \
+	src/yatta/directwriter.hh \
+	src/yatta/writeback.cc \
+	src/yatta/writeback.hh \
+	src/yatta/diskwriter.cc \
+	src/yatta/diskwriter.hh \
+	src/yatta/piecemap.cc \
+	src/yatta/piecemap.hh \
+	src/yatta/decoder.cc \
+	src/yatta/decoder.hh \
+	src/yatta/instance.cc \
+	src/yatta/instance.hh \
+	src/yatta/unixsocket.cc \
+	src/yatta/unixsocket.hh \
+	src/yatta/spscring.hh \
+	src/yatta/pool.hh
 
 AM_CXXFLAGS += \
 	-DDATADIR=\""$(pkgdatadir)"\"
 
+libyatta_la_CXXFLAGS += \
+	$(ZLIB_CFLAGS) \
+	$(ZSTD_CFLAGS) \
+	$(LZMA_CFLAGS)
+
+libyatta_la_LIBADD += \
+	$(ZLIB_LIBS) \
+	$(ZSTD_LIBS) \
+	$(LZMA_LIBS)
+
 include src/yatta/ui/rules.mk
 include src/yatta/curl/rules.mk
+include src/yatta/file/rules.mk
+include src/yatta/bench/rules.mk
+include src/yatta/tests/rules.mk
@@ -0,0 +1,97 @@
+/* spscring.hh -- lock-free single producer, single consumer ring
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_SPSCRING_H
+#define YATTA_SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace Yatta
+{
+    /**
+     * @brief: Fixed-size queue between exactly two threads
+     *
+     * One thread only ever push ()es and the other only ever pop ()s.
+     * Neither blocks: push () fails when the ring is full and pop ()
+     * when it's empty, and waking the other side up is left to the
+     * caller. Capacity must be a power of two. Meant for small things
+     * like pointers.
+     */
+    template <typename T, size_t Capacity>
+    class SPSCRing
+    {
+        static_assert (Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                       "SPSCRing capacity must be a power of two");
+
+    public:
+        SPSCRing () :
+            head (0),
+            tail (0)
+        {}
+
+        // producer side
+        bool push (const T &item)
+        {
+            size_t t = tail.load (std::memory_order_relaxed);
+            if (t - head.load (std::memory_order_acquire) == Capacity)
+                return false;
+
+            // the slot is filled before the consumer can see it
+            slots[t & mask] = item;
+            tail.store (t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side
+        bool pop (T &item)
+        {
+            size_t h = head.load (std::memory_order_relaxed);
+            if (h == tail.load (std::memory_order_acquire))
+                return false;
+
+            // and read before it's handed back
+            item = slots[h & mask];
+            head.store (h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // only exact from the consumer side
+        bool empty () const
+        {
+            return head.load (std::memory_order_acquire) ==
+                tail.load (std::memory_order_acquire);
+        }
+
+        static constexpr size_t capacity ()
+        {
+            return Capacity;
+        }
+
+    private:
+        static constexpr size_t mask = Capacity - 1;
+
+        // the indices only grow, and sit a cache line apart so the two
+        // threads don't fight over them
+        alignas (64) std::atomic<size_t> head;
+        alignas (64) std::atomic<size_t> tail;
+        alignas (64) T                   slots[Capacity];
+    };
+}
+
+#endif // YATTA_SPSCRING_H
@@ -0,0 +1,171 @@
+/* decoder-check.cc -- Decoder gets back what was compressed
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <zlib.h>
+
+#include "../decoder.hh"
+
+namespace
+{
+    bool check (const char *name, bool ok)
+    {
+        std::printf ("%s: %s\n", name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+
+    // window_bits as for deflateInit2: 31 for gzip, 15 for zlib, -15
+    // for raw deflate
+    std::string compress (const std::string &data, int window_bits)
+    {
+        z_stream stream = z_stream ();
+        deflateInit2 (&stream, Z_BEST_SPEED, Z_DEFLATED, window_bits, 8,
+                      Z_DEFAULT_STRATEGY);
+
+        std::string out (deflateBound (&stream, data.size ()), '\0');
+        stream.next_in =
+            reinterpret_cast<Bytef *> (const_cast<char *> (data.data ()));
+        stream.avail_in = data.size ();
+        stream.next_out = reinterpret_cast<Bytef *> (&out[0]);
+        stream.avail_out = out.size ();
+        deflate (&stream, Z_FINISH);
+        out.resize (stream.total_out);
+        deflateEnd (&stream);
+
+        return out;
+    }
+
+    // fed in pieces of step bytes, the way chunks hand data over
+    int decode (const std::string &encoding, const std::string &data,
+                size_t step, std::string &out)
+    {
+        std::unique_ptr<Yatta::Decoder> decoder =
+            Yatta::Decoder::create (encoding);
+        if (!decoder)
+            return -1;
+
+        bool in_order = true;
+        Yatta::Decoder::Output output =
+            [&out, &in_order] (const char *data, size_t size,
+                               size_t offset) {
+            in_order &= offset == out.size ();
+            out.append (data, size);
+            return 0;
+        };
+
+        for (size_t i = 0; i < data.size (); i += step) {
+            int error = decoder->decode (data.data () + i,
+                                         std::min (step, data.size () - i),
+                                         output);
+            if (error)
+                return error;
+        }
+
+        int error = decoder->finish (output);
+        if (error)
+            return error;
+
+        return in_order && decoder->position () == out.size () ? 0 : -1;
+    }
+
+    std::string sample ()
+    {
+        // compressible, and bigger than the decoder's buffer once
+        // decoded
+        std::string text;
+        for (int i = 0; text.size () < 3 * Yatta::Decoder::buffer_size; ++i)
+            text += "line " + std::to_string (i * 7919 % 1000) + "\n";
+        return text;
+    }
+
+    bool check_formats ()
+    {
+        std::string text = sample ();
+        std::string gzip, zlib, raw;
+        bool ok = true;
+
+        ok &= decode ("gzip", compress (text, 31), 1000, gzip) == 0 &&
+            gzip == text;
+        ok &= decode ("deflate", compress (text, 15), 7, zlib) == 0 &&
+            zlib == text;
+        ok &= decode ("deflate", compress (text, -15), 4096, raw) == 0 &&
+            raw == text;
+
+        std::string unknown;
+        ok &= decode ("br", text, 10, unknown) == -1 &&
+            !Yatta::Decoder::create ("identity");
+
+        return check ("formats", ok);
+    }
+
+    // gzip files are allowed to be several members back to back
+    bool check_members ()
+    {
+        std::string first = sample (), second = "and some more\n";
+        std::string out;
+
+        return check ("gzip members",
+                      decode ("gzip", compress (first, 31) +
+                              compress (second, 31), 333, out) == 0 &&
+                      out == first + second);
+    }
+
+    bool check_corrupt ()
+    {
+        std::string data = compress (sample (), 31);
+        data[data.size () / 2] ^= 0x55;
+        data[data.size () / 2 + 1] ^= 0x55;
+
+        std::string out;
+        return check ("corrupt data",
+                      decode ("gzip", data, 512, out) == EBADMSG &&
+                      decode ("gzip", "not gzip at all", 4, out) ==
+                      EBADMSG);
+    }
+
+    // a connection dropped early looks like the end of the body
+    bool check_truncated ()
+    {
+        std::string data = compress (sample (), 31);
+        std::string out;
+
+        return check ("truncated data",
+                      decode ("gzip", data.substr (0, data.size () / 2),
+                              100, out) == EBADMSG &&
+                      decode ("gzip", data.substr (0, data.size () - 4),
+                              100, out) == EBADMSG &&
+                      decode ("gzip", "", 100, out) == EBADMSG);
+    }
+}
+
+int main ()
+{
+    bool ok = true;
+
+    ok &= check_formats ();
+    ok &= check_members ();
+    ok &= check_corrupt ();
+    ok &= check_truncated ();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/* directwriter-check.cc -- DirectWriter puts every byte where it belongs
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../directwriter.hh"
+
+namespace
+{
+    char pattern (size_t offset)
+    {
+        return offset % 251;
+    }
+
+    struct Stream
+    {
+        size_t pos;
+        size_t end;
+    };
+
+    // split [0, size) into streams at boundaries, then feed them round
+    // robin in writes of odd sizes, the way chunks arrive
+    bool check (const char *name, const std::vector<size_t> &boundaries,
+                size_t size, size_t stage_size)
+    {
+        char path[] = "/tmp/yatta-directwriter-XXXXXX";
+        int buffered_fd = mkstemp (path);
+        if (buffered_fd < 0) {
+            std::perror ("mkstemp");
+            return false;
+        }
+
+        // tmpfs and friends don't do O_DIRECT; the logic is the same
+        int direct_fd = open (path, O_WRONLY | O_DIRECT);
+        if (direct_fd < 0 && errno == EINVAL)
+            direct_fd = open (path, O_WRONLY);
+
+        std::vector<Stream> streams;
+        for (size_t i = 0; i < boundaries.size (); ++i) {
+            Stream stream;
+            stream.pos = boundaries[i];
+            stream.end = i + 1 < boundaries.size () ?
+                boundaries[i + 1] : size;
+            streams.push_back (stream);
+        }
+
+        std::vector<char> data (size);
+        for (size_t i = 0; i < size; ++i)
+            data[i] = pattern (i);
+
+        Yatta::DirectWriter *writer =
+            new Yatta::DirectWriter (direct_fd, buffered_fd, stage_size);
+        bool ok = true;
+        size_t step = 0;
+
+        for (bool busy = true; busy && ok;) {
+            busy = false;
+            for (size_t i = 0; i < streams.size (); ++i) {
+                Stream &stream = streams[i];
+                if (stream.pos == stream.end)
+                    continue;
+
+                size_t n = 1 + (step++ * 7919) % 10007;
+                if (n > stream.end - stream.pos)
+                    n = stream.end - stream.pos;
+
+                ok = writer->write (stream.pos, &data[stream.pos], n) == 0;
+                stream.pos += n;
+                busy = true;
+            }
+        }
+
+        ok = ok && writer->flush () == 0;
+        delete writer;
+
+        close (direct_fd);
+        close (buffered_fd);
+
+        std::vector<char> result (size);
+        FILE *file = std::fopen (path, "rb");
+        struct stat st;
+        ok = ok && file && stat (path, &st) == 0 &&
+            size_t (st.st_size) == size &&
+            std::fread (&result[0], 1, size, file) == size &&
+            result == data;
+
+        if (file)
+            std::fclose (file);
+        unlink (path);
+
+        std::printf ("%s: %s\n", name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+}
+
+int main ()
+{
+    size_t block = Yatta::DirectWriter::alignment ();
+    bool ok = true;
+    std::vector<size_t> boundaries;
+
+    // one stream, ending off the boundary
+    boundaries.push_back (0);
+    ok &= check ("single stream", boundaries, 5 * block + 123, 3 * block);
+
+    // streams starting and ending mid-block
+    boundaries.clear ();
+    for (size_t i = 0; i < 8; ++i)
+        boundaries.push_back (i * (7 * block + 1001));
+    ok &= check ("unaligned streams", boundaries, 60 * block + 17,
+                 4 * block);
+
+    // a stream shorter than a block, inside one
+    boundaries.clear ();
+    boundaries.push_back (0);
+    boundaries.push_back (block + 10);
+    boundaries.push_back (block + 20);
+    ok &= check ("tiny stream", boundaries, 3 * block, block);
+
+    // more streams than there are stages
+    boundaries.clear ();
+    for (size_t i = 0; i < Yatta::DirectWriter::max_stages + 10; ++i)
+        boundaries.push_back (i * (3 * block + 333));
+    ok &= check ("stage eviction", boundaries,
+                 (Yatta::DirectWriter::max_stages + 10) * (3 * block + 333),
+                 2 * block);
+
+    return ok ? 0 : 1;
+}
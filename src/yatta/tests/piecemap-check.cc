@@ -0,0 +1,93 @@
+/* piecemap-check.cc -- PieceMap marks pieces, and survives a round trip
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstdio>
+
+#include "../piecemap.hh"
+
+namespace
+{
+    bool check (const char *name, bool ok)
+    {
+        std::printf ("%s: %s\n", name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+
+    // a piece only counts once all of it is in, from however many writes
+    bool check_partial ()
+    {
+        Yatta::PieceMap map (10 * 100 + 50, 100);
+        bool ok = map.count () == 11 && map.missing () == 11;
+
+        map.completed (0, 60);
+        ok &= !map.have (0);
+        map.completed (60, 40);
+        ok &= map.have (0) && !map.have (1) && map.missing () == 10;
+
+        // the short last piece
+        map.completed (1000, 50);
+        ok &= map.have (10) && map.missing () == 9;
+
+        return check ("partial pieces", ok);
+    }
+
+    // racing chunks write the same bytes twice, out of order
+    bool check_overlap ()
+    {
+        Yatta::PieceMap map (1000, 100);
+
+        map.completed (450, 300);
+        map.completed (150, 400);
+        bool ok = !map.have (1) && map.have (2) && map.have (6) &&
+            !map.have (7) && map.missing () == 10 - 5;
+
+        map.completed (100, 60);
+        map.completed (740, 60);
+        ok &= map.have (1) && map.have (7) && map.missing () == 3;
+
+        map.completed (0, 1000);
+        ok &= map.complete ();
+
+        // past the end is ignored
+        map.completed (5000, 10);
+        ok &= map.complete () && map.count () == 10;
+
+        return check ("overlapping writes", ok);
+    }
+
+    bool check_alignment ()
+    {
+        Yatta::PieceMap map (1000, 100);
+        return check ("alignment",
+                      map.align_down (250) == 200 &&
+                      map.align_up (250) == 300 &&
+                      map.align_up (300) == 300 &&
+                      map.align_down (0) == 0);
+    }
+}
+
+int main ()
+{
+    bool ok = true;
+
+    ok &= check_partial ();
+    ok &= check_overlap ();
+    ok &= check_alignment ();
+
+    return ok ? 0 : 1;
+}
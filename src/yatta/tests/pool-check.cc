@@ -0,0 +1,119 @@
+/* pool-check.cc -- Pool hands freed blocks back out
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "../pool.hh"
+
+namespace
+{
+    bool check (const char *name, bool ok)
+    {
+        std::printf ("%s: %s\n", name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+
+    struct Item : Yatta::Pooled<Item>
+    {
+        explicit Item (int value) : value (value) {}
+        virtual ~Item () {}
+
+        int value;
+        char padding[40];
+    };
+
+    // bigger than what the pool is for
+    struct BigItem : Item
+    {
+        BigItem () : Item (0) {}
+        char more[100];
+    };
+
+    bool check_reuse ()
+    {
+        Item *first = new Item (1);
+        delete first;
+        bool ok = Yatta::Pool<Item>::available () == 1;
+
+        Item *second = new Item (2);
+        ok &= second == first && second->value == 2 &&
+            Yatta::Pool<Item>::available () == 0;
+
+        // deleted through the base, and never pooled
+        Item *big = new BigItem;
+        delete big;
+        ok &= Yatta::Pool<Item>::available () == 0;
+
+        delete second;
+        return check ("reuse", ok);
+    }
+
+    bool check_limit ()
+    {
+        typedef Yatta::Pool<Item> Pool;
+        std::vector<Item *> items;
+
+        for (size_t i = 0; i < Pool::max_free + 10; ++i)
+            items.push_back (new Item (i));
+        for (size_t i = 0; i < items.size (); ++i)
+            delete items[i];
+
+        return check ("limit", Pool::available () == Pool::max_free);
+    }
+
+    bool check_allocator ()
+    {
+        typedef std::list<int, Yatta::PoolAllocator<int> > list_t;
+        list_t list;
+        bool ok = true;
+
+        // once warm, splitting and merging comes out of the free list
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 100; ++i)
+                list.push_back (i);
+            while (!list.empty ())
+                list.pop_front ();
+        }
+        for (int i = 0; i < 50; ++i)
+            list.insert (list.begin (), i);
+        ok &= list.size () == 50 && list.front () == 49;
+
+        std::shared_ptr<Item> item =
+            std::allocate_shared<Item> (Yatta::PoolAllocator<Item> (), 7);
+        std::weak_ptr<Item> weak = item;
+        ok &= item->value == 7;
+        item.reset ();
+        ok &= weak.expired ();
+
+        return check ("allocator", ok);
+    }
+}
+
+int main ()
+{
+    bool ok = true;
+
+    ok &= check_reuse ();
+    ok &= check_limit ();
+    ok &= check_allocator ();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/* queue-check.cc -- Queue carries on past downloads that fail
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <glibmm.h>
+#include <giomm/init.h>
+
+#include "../queue.hh"
+#include "../file/chunk.hh"
+
+namespace
+{
+    bool check (const char *name, bool ok)
+    {
+        std::printf ("%s: %s\n", name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+
+    void on_drained (Glib::RefPtr<Glib::MainLoop> loop)
+    {
+        loop->quit ();
+    }
+
+    bool on_timeout (Glib::RefPtr<Glib::MainLoop> loop, bool *timed_out)
+    {
+        *timed_out = true;
+        loop->quit ();
+        return false;
+    }
+
+    // with a single slot, a failed download that never gave it back
+    // would hold up everything behind it
+    bool check_failures (const std::string &dir)
+    {
+        std::string source = Glib::build_filename (dir, "source");
+        std::ofstream (source.c_str ()) << "some data\n";
+
+        std::string saved = Glib::build_filename (dir, "saved");
+        g_mkdir (saved.c_str (), 0700);
+
+        Yatta::Queue queue;
+        queue.max_active (1);
+        queue.small_file_limit (0);
+        for (int i = 0; i < 3; ++i)
+            queue.add ("file://" + dir + "/missing-" + std::to_string (i),
+                       saved);
+        queue.add ("file://" + source, saved);
+
+        Glib::RefPtr<Glib::MainLoop> loop = Glib::MainLoop::create ();
+        bool timed_out = false;
+        queue.connect_signal_drained
+            (sigc::bind (sigc::ptr_fun (&on_drained), loop));
+        Glib::signal_timeout ().connect_seconds
+            (sigc::bind (sigc::ptr_fun (&on_timeout), loop, &timed_out), 30);
+
+        queue.start ();
+        loop->run ();
+
+        return check ("failed downloads",
+                      !timed_out &&
+                      queue.count (Yatta::Queue::FAILED) == 3 &&
+                      queue.count (Yatta::Queue::FINISHED) == 1 &&
+                      queue.state (3) == Yatta::Queue::FINISHED);
+    }
+}
+
+int main ()
+{
+    Glib::init ();
+    Gio::init ();
+
+    Yatta::Chunk::register_factory
+        ("file", Yatta::ChunkFactoryPtr (new Yatta::File::ChunkFactory));
+
+    std::string dir = Glib::dir_make_tmp ("yatta-queue-check-XXXXXX");
+
+    bool ok = true;
+    ok &= check_failures (dir);
+
+    return ok ? 0 : 1;
+}
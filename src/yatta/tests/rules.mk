@@ -0,0 +1,37 @@
+check_PROGRAMS += directwriter-check spscring-check \
+	piecemap-check pool-check decoder-check queue-check
+TESTS += directwriter-check spscring-check \
+	piecemap-check pool-check decoder-check queue-check
+
+directwriter_check_SOURCES = \
+	src/yatta/tests/directwriter-check.cc \
+	src/yatta/directwriter.cc
+
+spscring_check_SOURCES = \
+	src/yatta/tests/spscring-check.cc
+spscring_check_LDFLAGS = -pthread
+
+piecemap_check_SOURCES = \
+	src/yatta/tests/piecemap-check.cc \
+	src/yatta/piecemap.cc
+
+pool_check_SOURCES = \
+	src/yatta/tests/pool-check.cc
+
+decoder_check_SOURCES = \
+	src/yatta/tests/decoder-check.cc \
+	src/yatta/decoder.cc
+decoder_check_CXXFLAGS = \
+	$(AM_CXXFLAGS) \
+	$(ZLIB_CFLAGS) \
+	$(ZSTD_CFLAGS) \
+	$(LZMA_CFLAGS)
+decoder_check_LDADD = \
+	$(ZLIB_LIBS) \
+	$(ZSTD_LIBS) \
+	$(LZMA_LIBS)
+
+queue_check_SOURCES = \
+	src/yatta/tests/queue-check.cc
+queue_check_LDADD = \
+	libyatta.la
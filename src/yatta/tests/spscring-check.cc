@@ -0,0 +1,96 @@
+/* spscring-check.cc -- SPSCRing hands items over intact and in order
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstdio>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "../spscring.hh"
+
+namespace
+{
+    const unsigned long count = 4 * 1000 * 1000;
+
+    struct Item
+    {
+        unsigned long sequence;
+        unsigned long check;
+    };
+
+    typedef Yatta::SPSCRing<Item, 256> Ring;
+
+    void *produce (void *data)
+    {
+        Ring *ring = static_cast<Ring *> (data);
+
+        for (unsigned long i = 0; i < count; ++i) {
+            Item item;
+            item.sequence = i;
+            item.check = ~i;
+
+            while (!ring->push (item))
+                sched_yield ();
+        }
+
+        return NULL;
+    }
+}
+
+int main ()
+{
+    static Ring ring;
+    bool ok = true;
+
+    // single thread: fills up, refuses, drains in order
+    Item item;
+    for (unsigned long i = 0; i < Ring::capacity (); ++i) {
+        item.sequence = i;
+        ok &= ring.push (item);
+    }
+    ok &= !ring.push (item);
+
+    for (unsigned long i = 0; i < Ring::capacity (); ++i)
+        ok &= ring.pop (item) && item.sequence == i;
+    ok &= !ring.pop (item) && ring.empty ();
+
+    std::printf ("single thread: %s\n", ok ? "ok" : "FAILED");
+
+    // two threads racing
+    pthread_t producer;
+    pthread_create (&producer, NULL, &produce, &ring);
+
+    bool ordered = true;
+    for (unsigned long expected = 0; expected < count;) {
+        if (!ring.pop (item)) {
+            sched_yield ();
+            continue;
+        }
+
+        if (item.sequence != expected || item.check != ~expected)
+            ordered = false;
+        ++expected;
+    }
+
+    pthread_join (producer, NULL);
+    ordered &= ring.empty ();
+
+    std::printf ("two threads: %s\n", ordered ? "ok" : "FAILED");
+
+    return ok && ordered ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/* trace.cc -- compile-time optional hot path tracepoints
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "trace.hh"
+
+#ifdef YATTA_ENABLE_TRACING
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+    struct Event
+    {
+        const char     *name;
+        gint64          ts;
+        gint64          dur;
+        long            value;
+        long            tid;
+        char            phase;
+        std::atomic<gulong> seq;   // claim number + 1 once published, 0
+                                   // while being filled in
+    };
+
+    const gulong capacity = 1 << 18;
+
+    Event ring[capacity];
+    std::atomic<gulong> head (0);
+
+    long thread_id ()
+    {
+        static thread_local long cached = 0;
+        if (!cached)
+            cached = syscall (SYS_gettid);
+        return cached;
+    }
+
+    // writers never wait on each other: each claims a slot with a single
+    // atomic increment and overwrites whatever was there
+    Event *claim (gulong &seq)
+    {
+        seq = head.fetch_add (1, std::memory_order_relaxed);
+        Event *event = &ring[seq % capacity];
+        event->seq.store (0, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+        return event;
+    }
+
+    void publish (Event *event, gulong seq)
+    {
+        event->seq.store (seq + 1, std::memory_order_release);
+    }
+
+    struct DumpAtExit
+    {
+        ~DumpAtExit ()
+        {
+            const char *path = std::getenv ("YATTA_TRACE");
+            if (path && *path)
+                Yatta::Trace::dump (path);
+        }
+    } dump_at_exit;
+}
+
+void Yatta::Trace::complete (const char *name, gint64 start, gint64 duration)
+{
+    gulong seq;
+    Event *event = claim (seq);
+    event->name = name;
+    event->ts = start;
+    event->dur = duration;
+    event->value = 0;
+    event->tid = thread_id ();
+    event->phase = 'X';
+    publish (event, seq);
+}
+
+void Yatta::Trace::counter (const char *name, long value)
+{
+    gulong seq;
+    Event *event = claim (seq);
+    event->name = name;
+    event->ts = g_get_monotonic_time ();
+    event->dur = 0;
+    event->value = value;
+    event->tid = thread_id ();
+    event->phase = 'C';
+    publish (event, seq);
+}
+
+void Yatta::Trace::instant (const char *name)
+{
+    gulong seq;
+    Event *event = claim (seq);
+    event->name = name;
+    event->ts = g_get_monotonic_time ();
+    event->dur = 0;
+    event->value = 0;
+    event->tid = thread_id ();
+    event->phase = 'i';
+    publish (event, seq);
+}
+
+bool Yatta::Trace::dump (const std::string &path)
+{
+    FILE *file = std::fopen (path.c_str (), "w");
+    if (!file)
+        return false;
+
+    gulong end = head.load (std::memory_order_acquire);
+    gulong start = end > capacity ? end - capacity : 0;
+    long pid = getpid ();
+    bool first = true;
+
+    std::fputs ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+    for (gulong seq = start; seq < end; ++seq) {
+        const Event &event = ring[seq % capacity];
+
+        // skip slots still being written or already lapped
+        if (event.seq.load (std::memory_order_acquire) != seq + 1)
+            continue;
+
+        std::fprintf (file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\","
+                      "\"ts\":%" G_GINT64_FORMAT ",\"pid\":%ld,\"tid\":%ld",
+                      first ? "" : ",", event.name, event.phase,
+                      event.ts, pid, event.tid);
+
+        if (event.phase == 'X')
+            std::fprintf (file, ",\"dur\":%" G_GINT64_FORMAT, event.dur);
+        else if (event.phase == 'C')
+            std::fprintf (file, ",\"args\":{\"value\":%ld}", event.value);
+        else
+            std::fputs (",\"s\":\"t\"", file);
+
+        std::fputc ('}', file);
+        first = false;
+    }
+
+    std::fputs ("\n]}\n", file);
+    return std::fclose (file) == 0;
+}
+
+#endif // YATTA_ENABLE_TRACING
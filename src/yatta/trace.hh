@@ -0,0 +1,92 @@
+/* trace.hh -- compile-time optional hot path tracepoints
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_TRACE_H
+#define YATTA_TRACE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/*
+ * Tracepoints are only compiled in with ./configure --enable-tracing.
+ * Events go into a fixed-size lock-free ring buffer which is written out
+ * as Chrome trace JSON (chrome://tracing, Perfetto) at exit, to the file
+ * named by $YATTA_TRACE. Without --enable-tracing the macros below
+ * expand to nothing.
+ */
+
+#ifdef YATTA_ENABLE_TRACING
+
+#include <string>
+#include <glib.h>
+
+namespace Yatta
+{
+    namespace Trace
+    {
+        // name must be a string literal; only the pointer is stored
+        void complete (const char *name, gint64 start, gint64 duration);
+        void counter (const char *name, long value);
+        void instant (const char *name);
+
+        bool dump (const std::string &path);
+
+        // records a complete event spanning its own lifetime
+        class Scope
+        {
+        public:
+            explicit Scope (const char *name) :
+                _name (name),
+                _start (g_get_monotonic_time ())
+            {}
+
+            ~Scope ()
+            {
+                complete (_name, _start, g_get_monotonic_time () - _start);
+            }
+
+        private:
+            const char *_name;
+            gint64      _start;
+        };
+    }
+}
+
+#define YATTA_TRACE_CAT2(a, b) a ## b
+#define YATTA_TRACE_CAT(a, b) YATTA_TRACE_CAT2 (a, b)
+
+#define YATTA_TRACE_SCOPE(name) \
+    ::Yatta::Trace::Scope YATTA_TRACE_CAT (yatta_trace_, __LINE__) (name)
+#define YATTA_TRACE_COMPLETE(name, start, duration) \
+    ::Yatta::Trace::complete ((name), (start), (duration))
+#define YATTA_TRACE_COUNTER(name, value) \
+    ::Yatta::Trace::counter ((name), (value))
+#define YATTA_TRACE_INSTANT(name) \
+    ::Yatta::Trace::instant (name)
+
+#else
+
+#define YATTA_TRACE_SCOPE(name)
+#define YATTA_TRACE_COMPLETE(name, start, duration)
+#define YATTA_TRACE_COUNTER(name, value)
+#define YATTA_TRACE_INSTANT(name)
+
+#endif // YATTA_ENABLE_TRACING
+
+#endif // YATTA_TRACE_H
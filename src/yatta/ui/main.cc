@@ -15,12 +15,15 @@
  *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <iostream>
+
 #include <gtkmm/main.h>
 
 #include "main.hh"
 #include "mainwindow.hh"
 #include "aboutdialog.hh"
 #include "../options.hh"
+#include "../metrics.hh"
 
 namespace Yatta
 {
@@ -28,31 +31,71 @@ namespace Yatta
     {
         struct Main::Priv
         {
-            Priv (Main &self, Options &options) :
-                mainwin (self),
+            Priv (Main &self, Options &options, gint64 started) :
+                self (self),
+                mainwin (),
                 aboutdlg (),
-                options (options) {}
-            MainWindow mainwin; // main window
-            About      aboutdlg; // about dialog
-            Options   &options;
+                options (options),
+                started (started),
+                map_connection () {}
+            Main                       &self;
+            std::unique_ptr<MainWindow> mainwin; // main window
+            std::unique_ptr<About>      aboutdlg; // about dialog, on demand
+            Options                    &options;
+            gint64                      started;
+            sigc::connection            map_connection;
+
+            void build_window ()
+            {
+                mainwin.reset (new MainWindow (self));
+                map_connection = mainwin->signal_map_event ().connect
+                    (sigc::mem_fun (*this, &Priv::on_first_map));
+                mainwin->show ();
+            }
+
+            bool on_first_map (GdkEventAny *)
+            {
+                map_connection.disconnect ();
+
+                double seconds = (g_get_monotonic_time () - started) / 1e6;
+                Metrics::get ().startup_done (seconds);
 
+                if (options.measure_startup ()) {
+                    std::cerr << "Startup took "
+                              << static_cast<long> (seconds * 1000)
+                              << " ms" << std::endl;
+                    Gtk::Main::quit ();
+                }
+
+                return false;
+            }
         };
 
-        Main::Main (int &argc, char **&argv, Options &options) :
+        Main::Main (int &argc, char **&argv, Options &options,
+                    gint64 started) :
             Gtk::Main (argc, argv, options),
-            _priv (new Priv (*this, options))
+            _priv (new Priv (*this, options,
+                             started ? started : g_get_monotonic_time ()))
         {
         }
 
         void Main::run ()
         {
-            _priv->mainwin.show ();
+            _priv->build_window ();
             Gtk::Main::run ();
         }
 
+        void Main::present ()
+        {
+            if (_priv->mainwin)
+                _priv->mainwin->present ();
+        }
+
         void Main::show_aboutdlg ()
         {
-            _priv->aboutdlg.show ();
+            if (!_priv->aboutdlg)
+                _priv->aboutdlg.reset (new About);
+            _priv->aboutdlg->show ();
         }
 
         Options &Main::options ()
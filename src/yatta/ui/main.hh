@@ -18,13 +18,11 @@
 #ifndef YATTA_UI_MAIN_H
 #define YATTA_UI_MAIN_H
 
-#include <tr1/memory>
+#include <memory>
 
+#include <glib.h>
 #include <gtkmm/main.h>
 
-#include "mainwindow.hh"
-#include "aboutdialog.hh"
-
 namespace Yatta
 {
     // forward decl
@@ -43,14 +41,22 @@ namespace Yatta
                  * @brief: Constructor
                  * @param argc Number of arguments
                  * @param argv Array of arguments
+                 * @param started g_get_monotonic_time () when we were
+                 * started, to time startup against. 0 for now
                  */
-                Main (int &argc, char **&argv, Options &options);
+                Main (int &argc, char **&argv, Options &options,
+                      gint64 started = 0);
 
                 /**
                  * @description: Run the main loop of the UI
                  */
                 void run ();
 
+                /**
+                 * @description: Bring the main window to the front
+                 */
+                void present ();
+
                 /**
                  * @description: Show the about dialog
                  */
@@ -69,7 +75,7 @@ namespace Yatta
 
             private:
                 struct Priv;
-                std::tr1::shared_ptr<Priv> _priv;
+                std::unique_ptr<Priv> _priv;
         };
     }
 }
@@ -34,11 +34,13 @@ namespace Yatta
                 uimgr (Gtk::UIManager::create ()),
                 statusbar (),
                 notebook (),
-                ui_main (ui_main) {}
+                ui_main (ui_main),
+                accels_loaded (false) {}
             Glib::RefPtr<Gtk::UIManager> uimgr;
             Gtk::Statusbar statusbar;
             Gtk::Notebook  notebook;
             Main &ui_main; // main UI object
+            bool  accels_loaded; // so an early exit doesn't clobber them
         };
 
         MainWindow::MainWindow (Main &ui_main) :
@@ -52,16 +54,26 @@ namespace Yatta
             // prepare widgets and show when idle
             construct_widgets ();
 
-            // TODO: use build_filename and don't repeat code
-            Gtk::AccelMap::load (Glib::get_user_config_dir () +
-                                 "/yatta/accels.map");
+            // custom shortcuts can wait until the window is up
+            Glib::signal_idle ().connect
+                (sigc::mem_fun (*this, &MainWindow::on_idle_load_accels));
         }
 
         MainWindow::~MainWindow ()
         {
-            // TODO: see note in constructor
-            Gtk::AccelMap::save (Glib::get_user_config_dir () +
+            // TODO: see note in on_idle_load_accels
+            if (_priv->accels_loaded)
+                Gtk::AccelMap::save (Glib::get_user_config_dir () +
+                                     "/yatta/accels.map");
+        }
+
+        bool MainWindow::on_idle_load_accels ()
+        {
+            // TODO: use build_filename and don't repeat code
+            Gtk::AccelMap::load (Glib::get_user_config_dir () +
                                  "/yatta/accels.map");
+            _priv->accels_loaded = true;
+            return false;
         }
 
         void MainWindow::construct_widgets ()
@@ -19,7 +19,7 @@
 #define YATTA_UI_MAINWINDOW_H
 
 #include <gtkmm/window.h>
-#include <tr1/memory>
+#include <memory>
 
 namespace Yatta
 {
@@ -53,8 +53,10 @@ namespace Yatta
                 virtual void on_hide ();
 
             private:
+                bool on_idle_load_accels ();
+
                 struct Priv;
-                std::tr1::shared_ptr<Priv> _priv;
+                std::unique_ptr<Priv> _priv;
 
                 // content automatically generated from *.ui
                 static const char *main_menu_uidata;
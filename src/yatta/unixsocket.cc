@@ -0,0 +1,51 @@
+/* unixsocket.cc -- helpers for the UNIX sockets we listen on
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "unixsocket.hh"
+
+bool Yatta::UnixSocket::stale (const std::string &path)
+{
+    struct sockaddr_un addr;
+    if (path.size () >= sizeof (addr.sun_path))
+        return false;
+
+    struct stat info;
+    if (lstat (path.c_str (), &info) < 0 || !S_ISSOCK (info.st_mode))
+        return false;
+
+    std::memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy (addr.sun_path, path.c_str ());
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    bool stale = connect (fd, reinterpret_cast<const sockaddr *> (&addr),
+                          sizeof (addr)) < 0 && errno == ECONNREFUSED;
+    close (fd);
+    return stale;
+}
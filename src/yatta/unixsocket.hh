@@ -0,0 +1,35 @@
+/* unixsocket.hh -- helpers for the UNIX sockets we listen on
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_UNIXSOCKET_H
+#define YATTA_UNIXSOCKET_H
+
+#include <string>
+
+namespace Yatta
+{
+    namespace UnixSocket
+    {
+        // true if path is a socket left over from a process that went
+        // away: it is a socket, and connecting to it is refused. nothing
+        // else found there is safe to remove
+        bool stale (const std::string &path);
+    }
+}
+
+#endif // YATTA_UNIXSOCKET_H
@@ -0,0 +1,119 @@
+/* workerpool.cc -- runs blocking jobs away from the main loop
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <sigc++/bind.h>
+#include <glibmm/threadpool.h>
+#include <glibmm/dispatcher.h>
+
+#include "workerpool.hh"
+
+using Yatta::WorkerPool;
+
+struct WorkerPool::Private
+{
+    Private () :
+        pool (default_threads),
+        dispatcher (),
+        next_ticket (0),
+        waiting (),
+        mutex (),
+        finished ()
+    {}
+
+    Glib::ThreadPool                 pool;
+    Glib::Dispatcher                 dispatcher;
+
+    // main loop only: done slots by ticket
+    unsigned long                    next_ticket;
+    std::map<unsigned long, Job>     waiting;
+
+    // shared with the workers, under mutex
+    std::mutex                       mutex;
+    std::vector<unsigned long>       finished;
+};
+
+const unsigned WorkerPool::default_threads;
+
+WorkerPool::WorkerPool ()
+{
+    _priv.reset (new Private);
+    _priv->dispatcher.connect (sigc::mem_fun (*this,
+                                              &WorkerPool::on_dispatch));
+}
+
+WorkerPool::~WorkerPool ()
+{
+    // let the jobs finish; nobody is left to hear about it
+    _priv->pool.shutdown ();
+}
+
+WorkerPool &WorkerPool::get ()
+{
+    static WorkerPool instance;
+    return instance;
+}
+
+void WorkerPool::push (const Job &job, const Job &done)
+{
+    unsigned long ticket = _priv->next_ticket++;
+    if (!done.empty ())
+        _priv->waiting[ticket] = done;
+
+    _priv->pool.push (sigc::bind (sigc::mem_fun (*this, &WorkerPool::run),
+                                  job, ticket));
+}
+
+// worker thread
+void WorkerPool::run (Job job, unsigned long ticket)
+{
+    job ();
+
+    {
+        std::lock_guard<std::mutex> lock (_priv->mutex);
+        _priv->finished.push_back (ticket);
+    }
+
+    _priv->dispatcher ();
+}
+
+// main loop
+void WorkerPool::on_dispatch ()
+{
+    std::vector<unsigned long> finished;
+    {
+        std::lock_guard<std::mutex> lock (_priv->mutex);
+        finished.swap (_priv->finished);
+    }
+
+    for (std::vector<unsigned long>::iterator i = finished.begin ();
+         i != finished.end (); ++i) {
+        std::map<unsigned long, Job>::iterator done =
+            _priv->waiting.find (*i);
+        if (done == _priv->waiting.end ())
+            continue;
+
+        // the slot may push more work, so take it out of the map first
+        Job slot = done->second;
+        _priv->waiting.erase (done);
+        slot ();
+    }
+}
@@ -0,0 +1,63 @@
+/* workerpool.hh -- runs blocking jobs away from the main loop
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_WORKERPOOL_H
+#define YATTA_WORKERPOOL_H
+
+#include <memory>
+
+#include <sigc++/slot.h>
+
+namespace Yatta
+{
+    /**
+     * @brief: A few threads for system calls that may block
+     *
+     * Each job runs on a worker thread, and its done slot then runs in
+     * the main loop. Jobs must not touch anything the main loop does
+     * without locking, and must not be bound to sigc::trackable
+     * objects; done slots have no such restriction since they never
+     * leave the main thread.
+     */
+    class WorkerPool
+    {
+    public:
+        typedef sigc::slot<void> Job;
+
+        static const unsigned default_threads = 4;
+
+        static WorkerPool &get ();
+
+        // run job on a worker, then done (if non-empty) in the main loop
+        void push (const Job &job, const Job &done = Job ());
+
+        ~WorkerPool ();
+
+    private:
+        WorkerPool ();
+        WorkerPool (const WorkerPool &) = delete;
+
+        void run (Job job, unsigned long ticket);
+        void on_dispatch ();
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_WORKERPOOL_H
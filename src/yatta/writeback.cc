@@ -0,0 +1,193 @@
+/* writeback.cc -- keeps dirty pages and cache use bounded while writing
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <map>
+#include <cerrno>
+
+#include <fcntl.h>
+
+#include "writeback.hh"
+
+using Yatta::Writeback;
+
+namespace
+{
+    // start writing [offset, offset + size) out, without waiting
+    int start_writeback (int fd, size_t offset, size_t size)
+    {
+#ifdef HAVE_SYNC_FILE_RANGE
+        if (sync_file_range (fd, offset, size, SYNC_FILE_RANGE_WRITE) != 0)
+            return errno;
+#else
+        (void) fd; (void) offset; (void) size;
+#endif
+        return 0;
+    }
+
+    // make sure [offset, offset + size) is on disk, then drop it
+    int finish_writeback (int fd, size_t offset, size_t size)
+    {
+#ifdef HAVE_SYNC_FILE_RANGE
+        if (sync_file_range (fd, offset, size,
+                             SYNC_FILE_RANGE_WAIT_BEFORE |
+                             SYNC_FILE_RANGE_WRITE |
+                             SYNC_FILE_RANGE_WAIT_AFTER) != 0)
+            return errno;
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+        // returns the error rather than setting errno
+        return posix_fadvise (fd, offset, size, POSIX_FADV_DONTNEED);
+#else
+        (void) fd; (void) offset; (void) size;
+        return 0;
+#endif
+    }
+}
+
+struct Writeback::Private
+{
+    struct Stream
+    {
+        size_t        start;     // first byte not yet handed to the kernel
+        size_t        end;       // next byte we expect
+        size_t        in_flight; // start of the window being written
+        unsigned long used;
+    };
+
+    // keyed by where the next write of the stream is expected
+    typedef std::map<size_t, Stream> stream_map_t;
+
+    Private (int fd, size_t window) :
+        fd (fd),
+        window (window),
+        streams (),
+        clock (0)
+    {}
+
+    // wait for the window in flight, and start the next one
+    int advance (Stream &s)
+    {
+        if (s.in_flight != s.start) {
+            int error = finish_writeback (fd, s.in_flight,
+                                          s.start - s.in_flight);
+            if (error)
+                return error;
+        }
+
+        int error = start_writeback (fd, s.start, window);
+        if (error)
+            return error;
+
+        s.in_flight = s.start;
+        s.start += window;
+        return 0;
+    }
+
+    int finish (Stream &s)
+    {
+        // a length of 0 would mean the whole rest of the file
+        if (s.end == s.in_flight)
+            return 0;
+
+        return finish_writeback (fd, s.in_flight, s.end - s.in_flight);
+    }
+
+    int evict ()
+    {
+        stream_map_t::iterator oldest = streams.begin ();
+        for (stream_map_t::iterator i = streams.begin ();
+             i != streams.end (); ++i)
+            if (i->second.used < oldest->second.used)
+                oldest = i;
+
+        Stream s = oldest->second;
+        streams.erase (oldest);
+        return finish (s);
+    }
+
+    int           fd;
+    size_t        window;
+    stream_map_t  streams;
+    unsigned long clock;
+};
+
+const size_t Writeback::default_window;
+const size_t Writeback::max_streams;
+
+Writeback::Writeback (int fd, size_t window) :
+    _priv (new Private (fd, window))
+{
+}
+
+Writeback::~Writeback ()
+{
+}
+
+int Writeback::written (size_t offset, size_t size)
+{
+    Private::Stream s;
+    Private::stream_map_t::iterator i = _priv->streams.find (offset);
+
+    if (i != _priv->streams.end ()) {
+        s = i->second;
+        _priv->streams.erase (i);
+    } else {
+        if (_priv->streams.size () >= max_streams) {
+            int error = _priv->evict ();
+            if (error)
+                return error;
+        }
+
+        s.start = s.end = s.in_flight = offset;
+    }
+
+    s.end += size;
+    s.used = ++_priv->clock;
+
+    int error = 0;
+    while (!error && s.end - s.start >= _priv->window)
+        error = _priv->advance (s);
+
+    // two streams only meet like this if they overlap; finish this one
+    if (!_priv->streams.insert (std::make_pair (s.end, s)).second) {
+        int final_error = _priv->finish (s);
+        error = error ? error : final_error;
+    }
+
+    return error;
+}
+
+int Writeback::flush ()
+{
+    int result = 0;
+
+    for (Private::stream_map_t::iterator i = _priv->streams.begin ();
+         i != _priv->streams.end (); ++i) {
+        int error = _priv->finish (i->second);
+        if (error && !result)
+            result = error;
+    }
+    _priv->streams.clear ();
+
+    return result;
+}
@@ -0,0 +1,66 @@
+/* writeback.hh -- keeps dirty pages and cache use bounded while writing
+ * Copyright © 2011, Chow Loong Jin <hyperair@ubuntu.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef YATTA_WRITEBACK_H
+#define YATTA_WRITEBACK_H
+
+#include <memory>
+#include <cstddef>
+
+namespace Yatta
+{
+    /**
+     * @brief: Streams written data out to disk and out of the page cache
+     *
+     * Told about every completed write, it follows each stream (chunk)
+     * separately. Whenever a stream has another window's worth of data,
+     * writeback of that window is started with sync_file_range. The
+     * window before it is then waited for and dropped with
+     * posix_fadvise (DONTNEED). So each stream has at most two windows
+     * dirty or cached, and the kernel never has a large backlog to
+     * flush all at once.
+     *
+     * Plain POSIX and synchronous, like DirectWriter. Without
+     * sync_file_range it only drops pages, and without posix_fadvise it
+     * does nothing at all. Errors are returned as errno values.
+     */
+    class Writeback
+    {
+    public:
+        static const size_t default_window = 8 * 1024 * 1024;
+        static const size_t max_streams = 64;
+
+        // fd is not closed by us
+        explicit Writeback (int fd, size_t window = default_window);
+        ~Writeback ();
+
+        // size bytes at offset have just been written
+        int written (size_t offset, size_t size);
+
+        // write out and drop everything that's still around
+        int flush ();
+
+    private:
+        Writeback (const Writeback &) = delete;
+
+        struct Private;
+        std::unique_ptr<Private> _priv;
+    };
+}
+
+#endif // YATTA_WRITEBACK_H